@@ -12,26 +12,36 @@
 
 namespace DragAndDrop {
 
+	const bigtime_t kReplyTimeout = 60000000; // 1 min
+	const bigtime_t kDeliveryTimeout = 5000000; // 5 sec
+
 	DragAndDrop::DragAndDrop(BMessage *dragMessage)
 		:
-		fNegotiationID(nullptr),
 		fIsNegotiated(true),
 		fDragMessage(dragMessage),
+		fNegotiationID(nullptr),
 		fSender(dragMessage->ReturnAddress()),
-		fCompleted(false)
+		fCompleted(false),
+		fProgress(0),
+		fDispatcher(nullptr)
 	{
 		// set message and negotiation ID
 		_DetectNegotiation();
 		fNegotiationID = BUuid().SetToRandom().ToString();
 		BString messageID = BUuid().SetToRandom().ToString();
-		fDragMessage->AddString("dropit:negotiation_id", fNegotiationID);
+		NegotiationNotice::Archive({fNegotiationID}, fDragMessage);
 
 		// printf("DragAndDrop::DragAndDrop return address Team = %d.\n", fSender.Team());
 	}
 
 
+	// Must be deleted on the looper of the dispatcher the negotiation runs
+	// on, which drops the wait for a reply.
 	DragAndDrop::~DragAndDrop()
 	{
+		if (fDispatcher != nullptr)
+			fDispatcher->Cancel(this);
+		delete fDragMessage;
 	}
 
 
@@ -40,27 +50,56 @@ namespace DragAndDrop {
 	{
 		BMessenger replyToMessenger(replyTo);
 		BMessage replyMessage(kMsgNegotiationFinished);
-		replyMessage.AddString("dropit:negotiation_id", fNegotiationID);
+		NegotiationNotice::Archive({fNegotiationID}, &replyMessage);
 		replyToMessenger.SendMessage(&replyMessage);
 		printf("kMsgNegotiationFinished sent\n");
 	}
 
-	void
-	DragAndDrop::ProcessReply(BMessage *message, BHandler *replyTo)
+	// Returns true if the drag message got delivered or the negotiation got
+	// completed since the last call.
+	bool
+	DragAndDrop::HasProgressed()
+	{
+		int32 progress = 0;
+		if (fCompleted)
+			progress = 2;
+		else if (fDragMessage->WasDelivered())
+			progress = 1;
+
+		bool progressed = progress != fProgress;
+		fProgress = progress;
+		return progressed;
+	}
+
+
+	// Follows one re-drag of the clip: waits for the drop target to answer
+	// the drag message and hands the answer over to the application the clip
+	// came from. Runs on the looper of the dispatcher, the outcome is
+	// reported to replyTo as kMsgReplyDelivered. A new drag of the clip
+	// drops the wait for an answer to the previous one.
+	Async
+	DragAndDrop::Negotiate(AsyncDispatcher *dispatcher, BMessenger replyTo)
 	{
-		// printf("DragAndDrop::ProcessReply.\n");
-		// message->PrintToStream();
+		dispatcher->Cancel(this);
+		fDispatcher = dispatcher;
+		AsyncReply reply = co_await dispatcher->AwaitReply(fDragMessage, kReplyTimeout,
+			this);
+		if (reply.status != B_OK)
+			co_return;
 
 		// check who sent this
-		team_id replyTeam = message->ReturnAddress().Team();
-		if (replyTeam != fSender.Team()) {
-			fSender.SendMessage(message);
-			while (!message->WasDelivered())
-				sleep(500);
-			// NotifyCompleted(replyTo);
-			Completed();
-			printf("reply was delivered, negotiation completed\n");
-		}
+		team_id replyTeam = reply.message.ReturnAddress().Team();
+		if (replyTeam == fSender.Team())
+			co_return;
+
+		// the answer is handed over even if this object goes away meanwhile
+		BString negotiationID = fNegotiationID;
+		status_t status = co_await dispatcher->AwaitDelivery(fSender, reply.message,
+			kDeliveryTimeout);
+
+		BMessage deliveredMessage(kMsgReplyDelivered);
+		ReplyDeliveredNotice::Archive({negotiationID, status}, &deliveredMessage);
+		replyTo.SendMessage(&deliveredMessage);
 	}
 
 	bool
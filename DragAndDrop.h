@@ -5,6 +5,9 @@
 
 #pragma once
 
+#include "interface/Async.hpp"
+#include "interface/MessageSchema.hpp"
+
 #include <Archivable.h>
 #include <SupportDefs.h>
 #include <String.h>
@@ -16,16 +19,47 @@
 class BHandler;
 class BMessage;
 
+using Genio::Task::Async;
+using Genio::Task::AsyncDispatcher;
+using Genio::Task::AsyncReply;
+
 namespace DragAndDrop {
 
 	static const int32 kMsgNegotiationFinished = 'mngf';
+	static const int32 kMsgReplyDelivered = 'mrdl';
+	static const int32 kMsgNegotiationStarted = 'mngs';
+	static const int32 kMsgNegotiationTimeout = 'mngt';
+
+	static const bigtime_t kNegotiationTimeout = 500000; // 0.5sec
+
+	// The drag message and kMsgNegotiationFinished, kMsgNegotiationStarted
+	struct negotiation_notice {
+		BString							negotiationID;
+	};
+
+	typedef MessageSchema<negotiation_notice,
+		message_field<"dropit:negotiation_id", &negotiation_notice::negotiationID> >
+		NegotiationNotice;
+
+	// kMsgReplyDelivered
+	struct reply_delivered_notice {
+		BString							negotiationID;
+		int32							status = B_ERROR;
+	};
+
+	typedef MessageSchema<reply_delivered_notice,
+		message_field<"dropit:negotiation_id", &reply_delivered_notice::negotiationID>,
+		message_field<"status", &reply_delivered_notice::status> >
+		ReplyDeliveredNotice;
 
 	class DragAndDrop: public BArchivable {
 	public:
 										DragAndDrop(BMessage *dragMessage);
+											// takes ownership of dragMessage
 										~DragAndDrop();
 
-		void							ProcessReply(BMessage *message, BHandler *replyTo);
+		Async							Negotiate(AsyncDispatcher *dispatcher,
+											BMessenger replyTo);
 		void							End() const;
 
 		bool							IsNegotiated() const;
@@ -36,6 +70,7 @@ namespace DragAndDrop {
 		bool							IsCompleted() const;
 		void							Completed();
 		void							NotifyCompleted(BHandler *replyTo);
+		bool							HasProgressed();
 
 	private:
 		bool							fIsNegotiated;
@@ -48,6 +83,9 @@ namespace DragAndDrop {
 		BMessenger						freceiver;
 
 		bool							fCompleted;
+		int32							fProgress;
+		AsyncDispatcher*				fDispatcher;
+			// the negotiation waits on, see ~DragAndDrop()
 	};
 
 }
\ No newline at end of file
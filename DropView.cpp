@@ -48,7 +48,7 @@ DropView::AttachedToWindow()
 
 
 void
-DropView::Draw(BRect updateRect)
+DropView::Draw(BRect /*updateRect*/)
 {
 	SetDrawingMode( B_OP_COPY );
 	SetHighColor(ui_color(B_CONTROL_BORDER_COLOR));
@@ -69,11 +69,19 @@ DropView::MessageReceived(BMessage *message)
 {
 	if (message->WasDropped()) {
 		// message->PrintToStream();
-		message->RemoveName("_drop_point_");
-		message->RemoveName("_drop_offset_");
-		BMessage *dropMsg = new BMessage(kMsgDropped);
-		dropMsg->AddMessage("dropped_message", message);
-		Window()->PostMessage(dropMsg);
+		// The window runs in our team, so it gets the dropped message itself
+		// instead of a flattened copy; it takes ownership.
+		BMessage *dropped;
+		if (Window()->CurrentMessage() == message)
+			dropped = Window()->DetachCurrentMessage();
+		else
+			dropped = new BMessage(*message);
+		dropped->RemoveName("_drop_point_");
+		dropped->RemoveName("_drop_offset_");
+		BMessage dropMsg(kMsgDropped);
+		dropMsg.AddPointer("dropped_message", dropped);
+		if (Window()->PostMessage(&dropMsg) != B_OK)
+			delete dropped;
 	} else {
 		BView::MessageReceived(message);
 	}
@@ -85,7 +93,7 @@ DropView::MouseMoved(BPoint point, uint32 transit, const BMessage *message)
 {
 	MainWindow *window = reinterpret_cast<MainWindow*>(Window());
 	if (message != nullptr) {
-		if (!message->HasString("dropit:negotiation_id")) {
+		if (!DragAndDrop::NegotiationNotice::Matches(*message)) {
 			switch (transit) {
 				case B_OUTSIDE_VIEW:
 				{
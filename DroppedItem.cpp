@@ -6,31 +6,26 @@
 
 #include "DroppedItem.h"
 #include "DragAndDrop.h"
+#include "DockListView.hpp"
+#include "MainWindow.h"
 #include "Utils.h"
-#include "interface/ObservableMap.hpp"
 
 #include <Bitmap.h>
 #include <Button.h>
 #include <Catalog.h>
 #include <LayoutUtils.h>
-#include <MessageRunner.h>
 #include <View.h>
 #include <Window.h>
 
 #include <cstdio>
 
-const int kTimeout = 500000; // 0.5sec
-const int kMsgTimeout = 'timo';
-
 #undef B_TRANSLATION_CONTEXT
 #define B_TRANSLATION_CONTEXT "Item"
 
 DroppedItem::DroppedItem(dnd *item)
 	: BView("item", B_WILL_DRAW | B_FRAME_EVENTS | B_DRAW_ON_CHILDREN),
-	fIcon(nullptr),
 	fItem(item),
-	fRunner(nullptr),
-	fTimeoutTask(nullptr),
+	fIcon(nullptr),
 	fRedragging(false)
 {
 	fLabel = fItem->DragMessage()->GetString("be:clip_name", B_TRANSLATE("Unknown clip"));
@@ -54,17 +49,12 @@ DroppedItem::AttachedToWindow()
 		128 * 0.5 - 1), B_RGBA32);
 	GetVectorIcon("default", fIcon);
 
-	if (Parent()->LockLooper()) {
-		Parent()->StartWatching(this, Observable::ItemErased);
-		Parent()->UnlockLooper();
-	}
-
 	_CalculateSize();
 }
 
 
 void
-DroppedItem::Draw(BRect updateRect)
+DroppedItem::Draw(BRect /*updateRect*/)
 {
 	// printf("DroppedItem::Draw(BRect updateRect) START\n");
 	SetDrawingMode(B_OP_ALPHA);
@@ -96,70 +86,51 @@ DroppedItem::MouseDown(BPoint where)
 	if (Bounds().Contains(where)) {
 		// printf("drag\n");
 		SetMouseEventMask(B_POINTER_EVENTS, 0);
-		fItem->DragMessage()->PrintToStream();
-		BBitmap *dragicon = new BBitmap(fIcon);
-		DragMessage(fItem->DragMessage(), dragicon, B_OP_ALPHA, BPoint(32,32), (BHandler*)Window());
+		StartDrag(this, fItem, Bounds());
 		fRedragging = true;
 	}
 }
 
 
 void
-DroppedItem::MouseUp(BPoint where)
+DroppedItem::MouseUp(BPoint /*where*/)
 {
-	fTimeoutTask = new Task<void>("timeoutTask", BMessenger(this),
-		[this]() {
-			BMessage timeoutMessage(kMsgTimeout);
-			fRunner = new BMessageRunner(BMessenger(this), &timeoutMessage, kTimeout, 1);
-			while (!fItem->DragMessage()->WasDelivered())
-				sleep(500);
-			fRunner->SetInterval(kTimeout);
-			while (!fItem->IsCompleted())
-				sleep(500);
-			fRunner->SetInterval(kTimeout);
-		}
-	);
-	fTimeoutTask->Run();
+	if (fRedragging)
+		EndDrag(this, fItem);
 	fRedragging = false;
 }
 
 
 void
-DroppedItem::MessageReceived(BMessage *message)
+DroppedItem::DescribeItem(dnd* item, dock_item_record* record)
 {
-	switch(message->what) {
-		case B_OBSERVER_NOTICE_CHANGE: {
-			message->PrintToStream();
-			int32 code;
-			message->FindInt32(B_OBSERVE_WHAT_CHANGE, &code);
-			if (code == Observable::ItemErased) {
-				printf("DroppedItem::MessageReceived() Observable::ItemErased\n");
-				GMessage *msg = (GMessage *)message;
-				BString negotiationID = (*msg)["key"];
-				// BString negotiationID = message->GetString("dropit:negotiation_id", "");
-				BString thisID = fItem->DragMessage()->GetString("dropit:negotiation_id", "");
-				if (negotiationID == thisID) {
-					printf("negotiationID == thisID\n");
-					RemoveSelf();
-					BMessenger sender;
-					message->FindMessenger("sender", &sender);
-					sender.SendMessage('rdlo');
-					delete this;
-				}
-			}
-			break;
-		}
-		case kMsgTimeout: {
-			printf("kMsgTimeout\n");
-			delete fRunner;
-			fRunner = nullptr;
-			fTimeoutTask->Stop();
-			fItem->NotifyCompleted((BHandler*)Window());
-			break;
-		}
-		default:
-			BView::MessageReceived(message);
-	}
+	record->icon = _SharedIcon();
+	record->label = item->DragMessage()->GetString("be:clip_name",
+		B_TRANSLATE("Unknown clip"));
+}
+
+
+void
+DroppedItem::StartDrag(BView* owner, dnd* item, BRect /*frame*/)
+{
+	item->DragMessage()->PrintToStream();
+	BBitmap *dragicon = new BBitmap(_SharedIcon());
+	MainWindow *window = reinterpret_cast<MainWindow*>(owner->Window());
+	// the drop target replies to the dispatcher, which resumes the
+	// negotiation
+	item->Negotiate(window->Dispatcher(), BMessenger(window));
+	owner->DragMessage(item->DragMessage(), dragicon, B_OP_ALPHA, BPoint(32,32),
+		window->Dispatcher());
+}
+
+
+void
+DroppedItem::EndDrag(BView* owner, dnd* item)
+{
+	// the window tracks the negotiation timeout from here on
+	BMessage message(DragAndDrop::kMsgNegotiationStarted);
+	DragAndDrop::NegotiationNotice::Archive({item->NegotiationID()}, &message);
+	owner->Window()->PostMessage(&message);
 }
 
 
@@ -190,6 +161,29 @@ DroppedItem::PreferredSize()
 }
 
 
+void
+DroppedItem::SetItem(dnd* item)
+{
+	fItem = item;
+	fLabel = fItem->DragMessage()->GetString("be:clip_name", B_TRANSLATE("Unknown clip"));
+	fRedragging = false;
+	Invalidate();
+}
+
+
+// One icon for all items drawn by the dock, it lives as long as the app
+const BBitmap*
+DroppedItem::_SharedIcon()
+{
+	static BBitmap* sIcon = nullptr;
+	if (sIcon == nullptr) {
+		sIcon = new BBitmap(BRect(0, 0, 128 * 0.5 - 1, 128 * 0.5 - 1), B_RGBA32);
+		GetVectorIcon("default", sIcon);
+	}
+	return sIcon;
+}
+
+
 void
 DroppedItem::_CalculateSize()
 {
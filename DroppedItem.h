@@ -6,14 +6,11 @@
 #pragma once
 
 #include "DragAndDrop.h"
-#include "interface/Task.hpp"
 
 #include <View.h>
 
 class BBitmap;
-class BMessageRunner;
-
-using namespace Genio::Task;
+struct dock_item_record;
 
 using dnd = DragAndDrop::DragAndDrop;
 
@@ -26,20 +23,27 @@ public:
 	virtual void 	Draw(BRect updateRect) override;
 	virtual	void	MouseDown(BPoint oldWhere) override;
 	virtual	void	MouseUp(BPoint oldWhere) override;
-	virtual void 	MessageReceived(BMessage *message) override;
 
 	virtual	BSize	MinSize() override;
 	virtual	BSize	MaxSize() override;
 	virtual	BSize	PreferredSize() override;
 
+			// Shows another item, for recycling the view
+			void	SetItem(dnd* item);
+
+			// Flyweight rendering by DockListView, without a view per item
+	static	void	DescribeItem(dnd* item, dock_item_record* record);
+	static	void	StartDrag(BView* owner, dnd* item, BRect frame);
+	static	void	EndDrag(BView* owner, dnd* item);
+
 private:
 	dnd*			fItem;
 	BBitmap*		fIcon;
-	BMessageRunner*	fRunner;
-	Task<void>*		fTimeoutTask;
 	bool			fRedragging;
 	BString			fLabel;
 	float			fLabelHeight;
 
 	void			_CalculateSize();
+
+	static	const BBitmap*	_SharedIcon();
 };
\ No newline at end of file
@@ -19,6 +19,7 @@
 #include <StringView.h>
 
 #include <cstdio>
+#include <cstring>
 
 
 MainWindow::MainWindow(void)
@@ -28,13 +29,20 @@ MainWindow::MainWindow(void)
 			B_WILL_ACCEPT_FIRST_CLICK | B_AVOID_FOCUS |	B_ASYNCHRONOUS_CONTROLS,
 			B_ALL_WORKSPACES),
 	fButton(nullptr),
-	fHasItems(false)
+	fHasItems(false),
+	fTimeouts(DragAndDrop::kMsgNegotiationTimeout)
 {
+	fTimeouts.SetTarget(BMessenger(this));
+
+	fDispatcher = new AsyncDispatcher();
+	AddHandler(fDispatcher);
+
 	fButton = new BButton("Dropped!", new BMessage(kMsgDismiss));
 	fDropView = new DropView();
 
-	auto gridList = new DockListView<DroppedItem, BString, DragAndDrop::DragAndDrop*>("dock",
-		&fNegotiations,	B_VERTICAL);
+	auto gridList = new DockListView<DroppedItem, BString,
+		DragAndDrop::DragAndDrop*, decltype(fNegotiations)>("dock",
+		&fNegotiations, B_VERTICAL, DOCK_LIST_VIRTUAL);
 
 	auto scrollView = new BScrollView("scroll_trans", gridList, B_WILL_DRAW,
 		false, true, B_PLAIN_BORDER);
@@ -49,30 +57,16 @@ MainWindow::MainWindow(void)
 }
 
 
+MainWindow::~MainWindow()
+{
+	for (auto& [negotiationID, dragAndDrop] : fNegotiations)
+		delete dragAndDrop;
+}
+
+
 void
 MainWindow::MessageReceived(BMessage *message)
 {
-	if (message->IsReply()) {
-		printf("MainWindow::MessageReceived Is Reply\n");
-		message->PrintToStream();
-		const BMessage *previous = message->Previous();
-		if (previous != nullptr) {
-			printf("MainWindow::MessageReceived previous message is present.\n");
-			BString negotiationID = previous->GetString("dropit:negotiation_id", "");
-			if (!negotiationID.IsEmpty()) {
-				printf("MainWindow::MessageReceived negotiationID = %s.\n", negotiationID.String());
-				fNegotiations.PrintKeysToStream();
-				if (fNegotiations.Find(negotiationID) != fNegotiations.end()) {
-					DragAndDrop::DragAndDrop *dnd = fNegotiations.Get(negotiationID);
-					printf("MainWindow::MessageReceived negotiation found.\n");
-					dnd->ProcessReply(message, this);
-				}
-			} else {
-				return; // TODO: log the error
-			}
-		}
-	}
-
 	switch(message->what) {
 		case kMsgDismiss: {
 			fPanels->SetVisibleItem(0);
@@ -82,8 +76,10 @@ MainWindow::MessageReceived(BMessage *message)
 		}
 		case kMsgDropped: {
 			// message->PrintToStream();
-			BMessage *droppedMsg = new BMessage();
-			if (message->FindMessage("dropped_message", droppedMsg) == B_OK) {
+			// owned by us now, see DropView::MessageReceived()
+			BMessage *droppedMsg = nullptr;
+			if (message->FindPointer("dropped_message", (void**)&droppedMsg) == B_OK
+				&& droppedMsg != nullptr) {
 				auto dragAndDrop = new DragAndDrop::DragAndDrop(droppedMsg);
 				fNegotiations.Insert(dragAndDrop->NegotiationID(), dragAndDrop);
 				fNegotiations.PrintKeysToStream();
@@ -103,16 +99,64 @@ MainWindow::MessageReceived(BMessage *message)
 			break;
 		}
 		case DragAndDrop::kMsgNegotiationFinished: {
-			BString negotiationID = message->GetString("dropit:negotiation_id", "");
+			DragAndDrop::negotiation_notice notice;
+			DragAndDrop::NegotiationNotice::Unarchive(*message, &notice);
+			const BString& negotiationID = notice.negotiationID;
 			printf("MainWindow::MessageReceived kMsgNegotiationFinished: %s\n", negotiationID.String());
 			fNegotiations.PrintKeysToStream();
+			fTimeouts.Cancel(negotiationID);
+			auto negotiation = fNegotiations.Find(negotiationID);
+			if (negotiation == fNegotiations.end())
+				break;
+
+			// the erase notice to the dock is queued already, delete the
+			// item only once the dock let go of it
+			BMessage deleteMessage(kMsgDeleteNegotiation);
+			deleteMessage.AddPointer("negotiation", negotiation->second);
 			fNegotiations.Erase(negotiationID);
+			PostMessage(&deleteMessage);
 			printf("MainWindow::MessageReceived %s erased\n", negotiationID.String());
 			fNegotiations.PrintKeysToStream();
 			fHasItems = fNegotiations.Size();
 			ShowWindow(fHasItems);
 			break;
 		}
+		case kMsgDeleteNegotiation: {
+			DragAndDrop::DragAndDrop *dragAndDrop = nullptr;
+			if (message->FindPointer("negotiation", (void**)&dragAndDrop) == B_OK)
+				delete dragAndDrop;
+			break;
+		}
+		case DragAndDrop::kMsgReplyDelivered: {
+			DragAndDrop::reply_delivered_notice reply;
+			DragAndDrop::ReplyDeliveredNotice::Unarchive(*message, &reply);
+			const BString& negotiationID = reply.negotiationID;
+			status_t status = reply.status;
+			if (fNegotiations.Find(negotiationID) != fNegotiations.end()) {
+				if (status == B_OK) {
+					fNegotiations.Get(negotiationID)->Completed();
+					printf("reply was delivered, negotiation completed\n");
+					if (fTimeouts.IsScheduled(negotiationID))
+						_ArmTimeout(negotiationID);
+				} else {
+					printf("MainWindow::MessageReceived reply to %s not delivered: %s\n",
+						negotiationID.String(), strerror(status));
+				}
+			}
+			break;
+		}
+		case DragAndDrop::kMsgNegotiationStarted: {
+			DragAndDrop::negotiation_notice notice;
+			DragAndDrop::NegotiationNotice::Unarchive(*message, &notice);
+			const BString& negotiationID = notice.negotiationID;
+			if (fNegotiations.Find(negotiationID) != fNegotiations.end())
+				_ArmTimeout(negotiationID);
+			break;
+		}
+		case DragAndDrop::kMsgNegotiationTimeout: {
+			_ExpireTimeouts();
+			break;
+		}
 		default: {
 			BWindow::MessageReceived(message);
 			break;
@@ -167,4 +211,32 @@ bool
 MainWindow::HasItems()
 {
 	return fHasItems;
+}
+
+void
+MainWindow::_ArmTimeout(const BString& negotiationID)
+{
+	// remember how far the negotiation got, see _ExpireTimeouts()
+	fNegotiations.Get(negotiationID)->HasProgressed();
+	fTimeouts.Schedule(negotiationID, system_time() + DragAndDrop::kNegotiationTimeout);
+}
+
+
+void
+MainWindow::_ExpireTimeouts()
+{
+	fTimeouts.Expire([this](const BString& negotiationID) {
+		if (fNegotiations.Find(negotiationID) == fNegotiations.end())
+			return;
+
+		DragAndDrop::DragAndDrop *dnd = fNegotiations.Get(negotiationID);
+		if (dnd->HasProgressed()) {
+			// the drag message got delivered or the reply went through in
+			// the meantime, give the negotiation another round
+			_ArmTimeout(negotiationID);
+		} else {
+			printf("MainWindow::_ExpireTimeouts %s timed out\n", negotiationID.String());
+			dnd->NotifyCompleted(this);
+		}
+	});
 }
\ No newline at end of file
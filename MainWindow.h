@@ -5,7 +5,8 @@
 
 #pragma once
 
-#include "interface/ObservableMap.hpp"
+#include "interface/DeadlineQueue.hpp"
+#include "interface/ObservableSequence.hpp"
 #include "DragAndDrop.h"
 
 #include <GroupView.h>
@@ -14,7 +15,7 @@
 
 #include <map>
 
-using Observable::ObservableMap;
+using Observable::ObservableSequence;
 
 class BButton;
 class BCardLayout;
@@ -26,6 +27,7 @@ class MainWindow : public BWindow
 {
 public:
 								MainWindow();
+	virtual						~MainWindow();
 
 	virtual void				MessageReceived(BMessage *msg) override;
 	virtual bool				QuitRequested(void) override;
@@ -35,12 +37,21 @@ public:
 	BRect						SensitiveArea();
 
 	bool						HasItems();
+	AsyncDispatcher*			Dispatcher() const { return fDispatcher; }
 private:
+	static const uint32			kMsgDeleteNegotiation = 'mdln';
+
 	BButton*					fButton;
 	bool						fHasItems;
 	BCardLayout*				fPanels;
 	DropView*					fDropView;
+	AsyncDispatcher*			fDispatcher;
 	BLayoutBuilder::Group<>		fDock;
 
-	ObservableMap<BString, DragAndDrop::DragAndDrop*> fNegotiations;
+	ObservableSequence<BString, DragAndDrop::DragAndDrop*> fNegotiations;
+		// in drop order
+	DeadlineQueue<BString>		fTimeouts;
+
+	void						_ArmTimeout(const BString& negotiationID);
+	void						_ExpireTimeouts();
 };
\ No newline at end of file
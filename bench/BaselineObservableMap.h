@@ -0,0 +1,252 @@
+/*
+ * Copyright 2024, Nexus6 <nexus6@disroot.org>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#pragma once
+
+// How ObservableMap notified its observers before notices were built in a
+// reused message, copied for NoticeBench: every change built a GMessage
+// from an initializer list that held each value in a shared_ptr, on the
+// heap and never deleted, and SendNotices() copied it once more. Only the
+// parts the bench uses are here, the list only takes the two value types
+// notices carry; the allocations per pair are the same as with all of
+// them.
+
+#include "interface/GMessage.hpp"
+#include "interface/ObservableMap.hpp"
+
+#include <Handler.h>
+#include <Messenger.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <variant>
+#include <vector>
+
+
+namespace Baseline {
+
+	using std::map;
+	using std::vector;
+
+	using mapped_type = std::variant<int32, BString>;
+
+	struct kv_pair : public std::pair<std::string, std::shared_ptr<mapped_type> >
+	{
+		kv_pair(const std::string &k, int32 v) : pair(k, std::make_shared<mapped_type>(v)) {}
+		kv_pair(const std::string &k, BString v) : pair(k, std::make_shared<mapped_type>(v)) {}
+	};
+
+	using variant_list = std::initializer_list<kv_pair>;
+
+
+	// GMessage(variant_list) and _HandleVariantList()
+	inline GMessage*
+	NewMessage(variant_list list)
+	{
+		GMessage* message = new GMessage();
+		message->MakeEmpty();
+		for (auto &[k, v]: list) {
+			std::visit([&] (const auto& z) { (*message)[k.c_str()] = z; }, *v);
+		}
+		return message;
+	}
+
+
+	class ObserverList {
+		public:
+			status_t SendNotices(uint32 what, const BMessage* notice);
+			status_t Add(const BHandler* handler, uint32 what);
+			status_t Add(const BMessenger& messenger, uint32 what);
+			status_t Remove(const BHandler* handler, uint32 what);
+			status_t Remove(const BMessenger& messenger, uint32 what);
+
+		private:
+			typedef map<uint32, vector<const BHandler*> > HandlerObserverMap;
+			typedef map<uint32, vector<BMessenger> > MessengerObserverMap;
+
+			void _ValidateHandlers(uint32 what);
+			void _SendNotices(uint32 what, BMessage* notice);
+
+			HandlerObserverMap		fHandlerMap;
+			MessengerObserverMap	fMessengerMap;
+	};
+
+
+	inline void
+	ObserverList::_ValidateHandlers(uint32 what)
+	{
+		vector<const BHandler*>& handlers = fHandlerMap[what];
+		vector<const BHandler*>::iterator iterator = handlers.begin();
+
+		while (iterator != handlers.end()) {
+			BMessenger target(*iterator);
+			if (!target.IsValid()) {
+				iterator++;
+				continue;
+			}
+
+			Add(target, what);
+			iterator = handlers.erase(iterator);
+		}
+		if (handlers.empty())
+			fHandlerMap.erase(what);
+	}
+
+
+	inline void
+	ObserverList::_SendNotices(uint32 what, BMessage* notice)
+	{
+		// first iterate over the list of handlers and try to make valid
+		// messengers out of them
+		_ValidateHandlers(what);
+
+		// now send it to all messengers we know
+		vector<BMessenger>& messengers = fMessengerMap[what];
+		vector<BMessenger>::iterator iterator = messengers.begin();
+
+		while (iterator != messengers.end()) {
+			if (!(*iterator).IsValid()) {
+				iterator = messengers.erase(iterator);
+				continue;
+			}
+
+			(*iterator).SendMessage(notice);
+			iterator++;
+		}
+		if (messengers.empty())
+			fMessengerMap.erase(what);
+	}
+
+
+	inline status_t
+	ObserverList::SendNotices(uint32 what, const BMessage* notice)
+	{
+		BMessage* copy = NULL;
+		if (notice != NULL) {
+			copy = new BMessage(*notice);
+			copy->what = B_OBSERVER_NOTICE_CHANGE;
+			copy->AddInt32(B_OBSERVE_ORIGINAL_WHAT, notice->what);
+		} else
+			copy = new BMessage(B_OBSERVER_NOTICE_CHANGE);
+
+		copy->AddInt32(B_OBSERVE_WHAT_CHANGE, what);
+
+		_SendNotices(what, copy);
+		_SendNotices(B_OBSERVER_OBSERVE_ALL, copy);
+
+		delete copy;
+
+		return B_OK;
+	}
+
+
+	inline status_t
+	ObserverList::Add(const BHandler* handler, uint32 what)
+	{
+		if (handler == NULL)
+			return B_BAD_HANDLER;
+
+		// if this handler already represents a valid target, add its messenger
+		BMessenger target(handler);
+		if (target.IsValid())
+			return Add(target, what);
+
+		vector<const BHandler*> &handlers = fHandlerMap[what];
+		if (std::find(handlers.begin(), handlers.end(), handler) == handlers.end())
+			handlers.push_back(handler);
+		return B_OK;
+	}
+
+
+	inline status_t
+	ObserverList::Add(const BMessenger &messenger, uint32 what)
+	{
+		vector<BMessenger> &messengers = fMessengerMap[what];
+		if (std::find(messengers.begin(), messengers.end(), messenger) == messengers.end())
+			messengers.push_back(messenger);
+		return B_OK;
+	}
+
+
+	inline status_t
+	ObserverList::Remove(const BHandler* handler, uint32 what)
+	{
+		if (handler == NULL)
+			return B_BAD_HANDLER;
+
+		// look into the list of messengers
+		BMessenger target(handler);
+		if (target.IsValid() && Remove(target, what) == B_OK)
+			return B_OK;
+
+		status_t status = B_BAD_HANDLER;
+		vector<const BHandler*> &handlers = fHandlerMap[what];
+		vector<const BHandler*>::iterator iterator = std::find(handlers.begin(),
+			handlers.end(), handler);
+		if (iterator != handlers.end()) {
+			handlers.erase(iterator);
+			status = B_OK;
+		}
+		if (handlers.empty())
+			fHandlerMap.erase(what);
+
+		return status;
+	}
+
+
+	inline status_t
+	ObserverList::Remove(const BMessenger &messenger, uint32 what)
+	{
+		status_t status = B_BAD_HANDLER;
+		vector<BMessenger> &messengers = fMessengerMap[what];
+		vector<BMessenger>::iterator iterator = std::find(messengers.begin(),
+			messengers.end(), messenger);
+		if (iterator != messengers.end()) {
+			messengers.erase(iterator);
+			status = B_OK;
+		}
+		if (messengers.empty())
+			fMessengerMap.erase(what);
+
+		return status;
+	}
+
+
+	// Insert() and Erase() with their notices, the observer list is
+	// created with the map rather than on demand
+	template<typename Key, typename Value>
+	class ObservableMap {
+	public:
+		void Insert(const Key& key, const Value& value)
+		{
+			fMap.insert_or_assign(key, value);
+			fObserverList.SendNotices(Observable::ItemInserted,
+				NewMessage({{"what", (int32)Observable::ItemInserted}, {"key", key}}));
+		}
+
+		bool Erase(const Key& key)
+		{
+			fObserverList.SendNotices(Observable::ItemErased,
+				NewMessage({{"what", (int32)Observable::ItemErased}, {"key", key}}));
+			return fMap.erase(key);
+		}
+
+		status_t StartWatching(BHandler* observer, uint32 what)
+		{
+			return fObserverList.Add(observer, what);
+		}
+
+		status_t StopWatching(BHandler* observer, uint32 what)
+		{
+			return fObserverList.Remove(observer, what);
+		}
+
+	private:
+		map<Key, Value>		fMap;
+		ObserverList		fObserverList;
+	};
+}
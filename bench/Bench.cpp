@@ -0,0 +1,84 @@
+/*
+ * Copyright 2024, Nexus6 <nexus6@disroot.org>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "Bench.h"
+
+#include <Application.h>
+
+#include <cstring>
+
+
+struct bench_entry {
+	const char*		name;
+	void			(*run)();
+};
+
+
+static const bench_entry kBenches[] = {
+	{ "negotiation", RunNegotiationBench },
+	{ "tasks", RunTaskBench },
+	{ "results", RunResultBench },
+	{ "shelf", RunShelfBench },
+	{ "notices", RunNoticeBench },
+	{ "storage", RunStorageBench },
+	{ "messages", RunMessageBench },
+};
+
+
+// Runs the benchmarks on a thread of their own, so the application looper
+// stays free for the windows and loopers they create.
+class BenchApp: public BApplication {
+public:
+	BenchApp(int argc, char** argv)
+		:
+		BApplication("application/x-vnd.nexus6-DropItBench"),
+		fCount(argc - 1),
+		fNames(argv + 1)
+	{
+	}
+
+	virtual void ReadyToRun() override
+	{
+		thread_id thread = spawn_thread(&_Run, "bench", B_NORMAL_PRIORITY, this);
+		if (thread < 0 || resume_thread(thread) != B_OK)
+			Quit();
+	}
+
+private:
+	static int32 _Run(void* data)
+	{
+		BenchApp* app = (BenchApp*)data;
+		for (const bench_entry& bench : kBenches) {
+			if (app->_IsSelected(bench.name))
+				bench.run();
+		}
+		app->PostMessage(B_QUIT_REQUESTED);
+		return B_OK;
+	}
+
+	bool _IsSelected(const char* name) const
+	{
+		if (fCount == 0)
+			return true;
+		for (int32 index = 0; index < fCount; index++) {
+			if (strcmp(fNames[index], name) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	int32		fCount;
+	char**		fNames;
+};
+
+
+int
+main(int argc, char** argv)
+{
+	BenchApp* app = new BenchApp(argc, argv);
+	app->Run();
+	delete app;
+	return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2024, Nexus6 <nexus6@disroot.org>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#pragma once
+
+#include <OS.h>
+#include <SupportDefs.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+
+// The benchmarks, run by name from the command line:
+//	DropItBench [name...]
+// Without names all of them run, one after the other.
+void	RunNegotiationBench();
+void	RunTaskBench();
+void	RunResultBench();
+void	RunShelfBench();
+void	RunNoticeBench();
+void	RunStorageBench();
+void	RunMessageBench();
+
+
+// Runs function count times, returns the microseconds one run took
+template<typename Function>
+double
+TimePerRun(int32 count, Function function)
+{
+	bigtime_t start = system_time();
+	for (int32 run = 0; run < count; run++)
+		function(run);
+	return double(system_time() - start) / count;
+}
+
+
+// The sample fraction of the samples are not larger than, sorts them
+inline bigtime_t
+Percentile(std::vector<bigtime_t>& samples, double fraction)
+{
+	if (samples.empty())
+		return 0;
+
+	std::sort(samples.begin(), samples.end());
+	size_t index = std::min(samples.size() - 1, size_t(fraction * samples.size()));
+	return samples[index];
+}
+
+
+inline void
+Report(const char* bench, const char* variant, double value, const char* unit)
+{
+	printf("%-14s %-36s %14.2f %s\n", bench, variant, value, unit);
+}
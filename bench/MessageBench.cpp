@@ -0,0 +1,98 @@
+/*
+ * Copyright 2024, Nexus6 <nexus6@disroot.org>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+// Reading and writing msg["a"]["b"]["c"], three levels of nested messages
+// with a few more fields each. The accessors against what they did before:
+// take a copy of every level on the heap and write each one back into its
+// parent when done, whether something changed or not. Reads through an
+// accessor that is held share the levels it loaded.
+
+#include "Bench.h"
+
+#include "interface/GMessage.hpp"
+
+#include <Message.h>
+
+
+static const int32 kRuns = 20000;
+static const char* kLevels[] = { "a", "b", "c" };
+
+
+static void
+AddPadding(BMessage* message)
+{
+	char name[16];
+	for (int32 index = 0; index < 10; index++) {
+		snprintf(name, sizeof(name), "field %" B_PRId32, index);
+		message->AddInt32(name, index);
+	}
+	message->AddString("label", "a label of some length, like the ones drops carry");
+}
+
+
+static void
+BuildNested(GMessage* message)
+{
+	BMessage levelB;
+	AddPadding(&levelB);
+	levelB.AddInt32("c", 0);
+	BMessage levelA;
+	AddPadding(&levelA);
+	levelA.AddMessage("b", &levelB);
+	AddPadding(message);
+	message->AddMessage("a", &levelA);
+}
+
+
+// How GMessageReturn accessed msg["a"]["b"]["c"] before
+static int32
+CopyLevels(BMessage* message, const int32* value)
+{
+	BMessage* levelA = new BMessage();
+	message->FindMessage(kLevels[0], levelA);
+	BMessage* levelB = new BMessage();
+	levelA->FindMessage(kLevels[1], levelB);
+
+	int32 result = value != NULL ? *value : levelB->GetInt32(kLevels[2], -1);
+	if (value != NULL)
+		levelB->SetInt32(kLevels[2], *value);
+
+	levelA->ReplaceMessage(kLevels[1], levelB);
+	delete levelB;
+	message->ReplaceMessage(kLevels[0], levelA);
+	delete levelA;
+	return result;
+}
+
+
+void
+RunMessageBench()
+{
+	GMessage message;
+	BuildNested(&message);
+	// keeps the reads from being optimized away
+	volatile int32 read = 0;
+
+	Report("messages", "3 levels, read, accessor", TimePerRun(kRuns, [&](int32) {
+		read = (int32)message["a"]["b"]["c"];
+	}), "us");
+	Report("messages", "3 levels, read, copies (before)", TimePerRun(kRuns, [&](int32) {
+		read = CopyLevels(&message, NULL);
+	}), "us");
+	Report("messages", "3 levels, 2 reads, held accessor", TimePerRun(kRuns, [&](int32) {
+		// the first level is loaded once for both reads
+		GMessageReturn levelA = message["a"];
+		read = (int32)levelA["b"]["c"] + (int32)levelA["b"]["field 0"];
+	}), "us");
+	Report("messages", "3 levels, write, accessor", TimePerRun(kRuns, [&](int32 run) {
+		message["a"]["b"]["c"] = run;
+	}), "us");
+	Report("messages", "3 levels, write, copies (before)", TimePerRun(kRuns, [&](int32 run) {
+		CopyLevels(&message, &run);
+	}), "us");
+
+	if ((int32)message["a"]["b"]["c"] != kRuns - 1)
+		printf("messages: write got lost\n");
+}
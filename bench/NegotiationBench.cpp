@@ -0,0 +1,225 @@
+/*
+ * Copyright 2024, Nexus6 <nexus6@disroot.org>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+// Pushes many negotiations through the steps DragAndDrop::Negotiate() takes
+// on the window looper at once: wait for the drop target to answer, then
+// hand the answer over to the application the clip came from. That one is
+// slow and its port small, so handing over has to be retried. Reports how
+// long each negotiation took until the answer arrived, and how long the
+// window took to answer a ping meanwhile.
+// Negotiate() itself ignores answers from its own team, so the bench
+// awaits on the AsyncDispatcher directly.
+
+#include "Bench.h"
+
+#include "interface/Async.hpp"
+
+#include <Looper.h>
+#include <Message.h>
+#include <Messenger.h>
+
+#include <cstring>
+
+
+using Genio::Task::Async;
+using Genio::Task::AsyncDispatcher;
+using Genio::Task::AsyncReply;
+
+static const uint32 kMsgStart = 'bnst';
+static const uint32 kMsgDrag = 'bndr';
+static const uint32 kMsgAnswer = 'bnan';
+static const uint32 kMsgPing = 'bnpi';
+
+static const bigtime_t kSenderDelay = 200;
+static const int32 kSenderPortCapacity = 20;
+
+
+// The application the clips came from, takes its time for every answer
+class SenderLooper: public BLooper {
+public:
+	SenderLooper(int32 count)
+		:
+		BLooper("bench sender", B_NORMAL_PRIORITY, kSenderPortCapacity),
+		fCount(count),
+		fDone(create_sem(0, "bench negotiations done"))
+	{
+		fLatencies.reserve(count);
+	}
+
+	virtual ~SenderLooper()
+	{
+		delete_sem(fDone);
+	}
+
+	virtual void MessageReceived(BMessage* message) override
+	{
+		if (message->what != kMsgAnswer) {
+			BLooper::MessageReceived(message);
+			return;
+		}
+
+		snooze(kSenderDelay);
+		fLatencies.push_back(system_time() - message->GetInt64("start", 0));
+		if ((int32)fLatencies.size() == fCount)
+			release_sem(fDone);
+	}
+
+	sem_id Done() const { return fDone; }
+	std::vector<bigtime_t>& Latencies() { return fLatencies; }
+
+private:
+	int32					fCount;
+	sem_id					fDone;
+	std::vector<bigtime_t>	fLatencies;
+};
+
+
+// Answers every drag message right away
+class TargetLooper: public BLooper {
+public:
+	TargetLooper()
+		:
+		BLooper("bench target")
+	{
+	}
+
+	virtual void MessageReceived(BMessage* message) override
+	{
+		if (message->what != kMsgDrag) {
+			BLooper::MessageReceived(message);
+			return;
+		}
+
+		BMessage answer(kMsgAnswer);
+		answer.AddInt64("start", message->GetInt64("start", 0));
+		message->SendReply(&answer);
+	}
+};
+
+
+static Async
+Negotiate(AsyncDispatcher* dispatcher, BMessenger target, BMessenger sender)
+{
+	BMessage drag(kMsgDrag);
+	drag.AddInt64("start", system_time());
+	AsyncReply reply = co_await dispatcher->SendAndAwaitReply(target, drag, 5000000);
+	if (reply.status != B_OK) {
+		printf("negotiation: no answer (%s)\n", strerror(reply.status));
+		co_return;
+	}
+
+	status_t status = co_await dispatcher->AwaitDelivery(sender, reply.message, 5000000);
+	if (status != B_OK)
+		printf("negotiation: answer not delivered (%s)\n", strerror(status));
+}
+
+
+// Stands in for MainWindow
+class WindowLooper: public BLooper {
+public:
+	WindowLooper(BMessenger target, BMessenger sender)
+		:
+		BLooper("bench window"),
+		fTarget(target),
+		fSender(sender)
+	{
+		fDispatcher = new AsyncDispatcher();
+		AddHandler(fDispatcher);
+	}
+
+	virtual void MessageReceived(BMessage* message) override
+	{
+		switch (message->what) {
+			case kMsgStart: {
+				int32 count = message->GetInt32("count", 0);
+				for (int32 index = 0; index < count; index++)
+					Negotiate(fDispatcher, fTarget, fSender);
+				break;
+			}
+			case kMsgPing:
+				message->SendReply(kMsgPing);
+				break;
+			default:
+				BLooper::MessageReceived(message);
+		}
+	}
+
+private:
+	AsyncDispatcher*		fDispatcher;
+	BMessenger				fTarget;
+	BMessenger				fSender;
+};
+
+
+static void
+QuitLooper(BLooper* looper)
+{
+	if (looper->Lock())
+		looper->Quit();
+}
+
+
+static void
+RunNegotiations(int32 count)
+{
+	SenderLooper* sender = new SenderLooper(count);
+	TargetLooper* target = new TargetLooper();
+	sender->Run();
+	target->Run();
+	WindowLooper* window = new WindowLooper(BMessenger(target), BMessenger(sender));
+	BMessenger windowMessenger(window);
+	window->Run();
+
+	BMessage start(kMsgStart);
+	start.AddInt32("count", count);
+	bigtime_t startTime = system_time();
+	windowMessenger.SendMessage(&start);
+
+	std::vector<bigtime_t> pings;
+	status_t status;
+	do {
+		bigtime_t pingTime = system_time();
+		BMessage ping(kMsgPing);
+		BMessage pong;
+		windowMessenger.SendMessage(&ping, &pong);
+		pings.push_back(system_time() - pingTime);
+
+		status = acquire_sem_etc(sender->Done(), 1, B_RELATIVE_TIMEOUT, 1000);
+	} while (status == B_TIMED_OUT && system_time() - startTime < 30000000);
+	bigtime_t total = system_time() - startTime;
+
+	char variant[64];
+	if (status != B_OK) {
+		// the sender may still be taking replies
+		size_t done = 0;
+		if (sender->Lock()) {
+			done = sender->Latencies().size();
+			sender->Unlock();
+		}
+		snprintf(variant, sizeof(variant), "%" B_PRId32 " at once", count);
+		Report("negotiation", variant, done, "done, timed out");
+	} else {
+		snprintf(variant, sizeof(variant), "%" B_PRId32 " at once, p50", count);
+		Report("negotiation", variant, Percentile(sender->Latencies(), 0.5), "us");
+		snprintf(variant, sizeof(variant), "%" B_PRId32 " at once, p99", count);
+		Report("negotiation", variant, Percentile(sender->Latencies(), 0.99), "us");
+		snprintf(variant, sizeof(variant), "%" B_PRId32 " at once, all", count);
+		Report("negotiation", variant, total, "us");
+	}
+	snprintf(variant, sizeof(variant), "%" B_PRId32 " at once, window ping p99", count);
+	Report("negotiation", variant, Percentile(pings, 0.99), "us");
+
+	QuitLooper(window);
+	QuitLooper(target);
+	QuitLooper(sender);
+}
+
+
+void
+RunNegotiationBench()
+{
+	RunNegotiations(100);
+	RunNegotiations(500);
+}
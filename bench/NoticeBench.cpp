@@ -0,0 +1,144 @@
+/*
+ * Copyright 2024, Nexus6 <nexus6@disroot.org>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+// Heap allocations per ObservableMap change, counted by replacing the
+// global operator new. Only the allocations made by the changing thread
+// while a change is measured count, not those of the observer's looper or
+// of setting up. The "before" lines run the notice path ObservableMap had
+// before it reused one message, see BaselineObservableMap.h.
+
+#include "Bench.h"
+#include "BaselineObservableMap.h"
+
+#include "interface/ObservableMap.hpp"
+
+#include <Looper.h>
+#include <Message.h>
+#include <Messenger.h>
+#include <String.h>
+
+#include <cstdlib>
+#include <new>
+
+
+static thread_local bool sCounting = false;
+static thread_local int64 sAllocations = 0;
+
+
+void*
+operator new(size_t size)
+{
+	if (sCounting)
+		sAllocations++;
+	void* pointer = malloc(size == 0 ? 1 : size);
+	if (pointer == NULL)
+		throw std::bad_alloc();
+	return pointer;
+}
+
+
+void
+operator delete(void* pointer) noexcept
+{
+	free(pointer);
+}
+
+
+void
+operator delete(void* pointer, size_t) noexcept
+{
+	free(pointer);
+}
+
+
+using Observable::ObservableMap;
+
+static const int32 kChangeCount = 10000;
+
+
+// Takes the notices and drops them
+class NoticeSink: public BLooper {
+public:
+	NoticeSink()
+		:
+		BLooper("bench notices")
+	{
+	}
+
+	virtual void MessageReceived(BMessage* message) override
+	{
+		if (message->what != B_OBSERVER_NOTICE_CHANGE)
+			BLooper::MessageReceived(message);
+	}
+};
+
+
+template<typename Function>
+static double
+AllocationsPerRun(int32 count, Function function)
+{
+	sAllocations = 0;
+	sCounting = true;
+	for (int32 run = 0; run < count; run++)
+		function(run);
+	sCounting = false;
+	return double(sAllocations) / count;
+}
+
+
+void
+RunNoticeBench()
+{
+	// 36 characters like the negotiation IDs, made before counting
+	std::vector<BString> keys(kChangeCount);
+	for (int32 index = 0; index < kChangeCount; index++)
+		keys[index].SetToFormat("%08" B_PRIx32 "-0000-4000-8000-000000000000", index);
+
+	NoticeSink* sink = new NoticeSink();
+	sink->Run();
+
+	{
+		ObservableMap<BString, int32> map;
+		Report("notices", "insert, unobserved",
+			AllocationsPerRun(kChangeCount, [&](int32 run) {
+				map.Insert(keys[run], run);
+			}), "allocs/op");
+	}
+
+	{
+		ObservableMap<BString, int32> map;
+		map.StartWatching(sink, Observable::ItemInserted);
+		map.StartWatching(sink, Observable::ItemErased);
+		Report("notices", "insert, observed",
+			AllocationsPerRun(kChangeCount, [&](int32 run) {
+				map.Insert(keys[run], run);
+			}), "allocs/op");
+		Report("notices", "erase, observed",
+			AllocationsPerRun(kChangeCount, [&](int32 run) {
+				map.Erase(keys[run]);
+			}), "allocs/op");
+		map.StopWatching(sink, Observable::ItemInserted);
+		map.StopWatching(sink, Observable::ItemErased);
+	}
+
+	{
+		Baseline::ObservableMap<BString, int32> map;
+		map.StartWatching(sink, Observable::ItemInserted);
+		map.StartWatching(sink, Observable::ItemErased);
+		Report("notices", "insert, observed (before)",
+			AllocationsPerRun(kChangeCount, [&](int32 run) {
+				map.Insert(keys[run], run);
+			}), "allocs/op");
+		Report("notices", "erase, observed (before)",
+			AllocationsPerRun(kChangeCount, [&](int32 run) {
+				map.Erase(keys[run]);
+			}), "allocs/op");
+		map.StopWatching(sink, Observable::ItemInserted);
+		map.StopWatching(sink, Observable::ItemErased);
+	}
+
+	if (sink->Lock())
+		sink->Quit();
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2024, Nexus6 <nexus6@disroot.org>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+// Time to hand a large task result over in a TASK_RESULT_MESSAGE and take
+// it out again: through the result slot, as within the team, against
+// archiving the result itself and flattening the message, as for another
+// team.
+
+#include "Bench.h"
+
+#include "interface/Task.hpp"
+
+#include <Message.h>
+#include <Referenceable.h>
+#include <String.h>
+
+
+using Genio::Task::TaskResult;
+using Genio::Task::TASK_RESULT_MESSAGE;
+using Genio::Task::Private::ResultSlot;
+
+
+static void
+HandOver(const BString& payload, int32 runs, bool archive)
+{
+	double perRun = TimePerRun(runs, [&](int32) {
+		BReference<ResultSlot<BString> > slot(new ResultSlot<BString>(), true);
+		slot->SetValue(BString(payload));
+		TaskResult<BString> sent("bench", 0, slot);
+
+		BMessage message(TASK_RESULT_MESSAGE);
+		BString value;
+		if (archive) {
+			sent.Archive(&message, false);
+			std::vector<char> buffer(message.FlattenedSize());
+			message.Flatten(buffer.data(), buffer.size());
+			BMessage arrived;
+			arrived.Unflatten(buffer.data());
+			TaskResult<BString> received(arrived);
+			value = received.TakeResult();
+		} else {
+			sent.ArchiveSlot(&message, BMessenger());
+			TaskResult<BString> received(&message);
+			value = received.TakeResult();
+		}
+		if (value.Length() != payload.Length())
+			printf("results: payload got lost\n");
+	});
+
+	char variant[64];
+	snprintf(variant, sizeof(variant), "%" B_PRId32 " KiB, %s", payload.Length() / 1024,
+		archive ? "archived" : "slot");
+	Report("results", variant, perRun, "us");
+}
+
+
+void
+RunResultBench()
+{
+	const int32 kSizes[] = { 1024, 64 * 1024, 1024 * 1024 };
+	const int32 kRuns[] = { 10000, 1000, 100 };
+
+	for (int32 index = 0; index < 3; index++) {
+		BString payload;
+		payload.SetTo('x', kSizes[index]);
+		HandOver(payload, kRuns[index], false);
+		HandOver(payload, kRuns[index], true);
+	}
+}
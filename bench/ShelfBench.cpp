@@ -0,0 +1,153 @@
+/*
+ * Copyright 2024, Nexus6 <nexus6@disroot.org>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+// Time to empty a shelf of 5000 items shown by a DockListView, erasing
+// them one by one as finished negotiations do, or all at once with
+// Clear(). Counted until the window handled every notice the dock got.
+
+#include "Bench.h"
+
+#include "interface/DockListView.hpp"
+#include "interface/ObservableMap.hpp"
+
+#include <LayoutBuilder.h>
+#include <Message.h>
+#include <Messenger.h>
+#include <ScrollView.h>
+#include <View.h>
+#include <Window.h>
+
+
+using Observable::ObservableMap;
+
+static const uint32 kMsgFill = 'bsfl';
+static const uint32 kMsgEraseAll = 'bser';
+static const uint32 kMsgClear = 'bscl';
+static const uint32 kMsgSync = 'bssy';
+
+static const int32 kShelfSize = 5000;
+
+
+class ShelfItem: public BView {
+public:
+	ShelfItem(int32 /*item*/)
+		:
+		BView("item", B_WILL_DRAW)
+	{
+		SetExplicitSize(BSize(63, 63));
+	}
+
+	void SetItem(int32 /*item*/)
+	{
+	}
+
+	// Flyweight mode isn't measured
+	static void DescribeItem(int32 /*item*/, dock_item_record* /*record*/) {}
+	static void StartDrag(BView* /*owner*/, int32 /*item*/, BRect /*frame*/) {}
+	static void EndDrag(BView* /*owner*/, int32 /*item*/) {}
+};
+
+
+typedef ObservableMap<int32, int32> Shelf;
+
+
+class ShelfWindow: public BWindow {
+public:
+	// The shelf has to outlive the window, the dock stops watching it when
+	// the window goes away.
+	ShelfWindow(Shelf* shelf, dock_list_mode mode)
+		:
+		BWindow(BRect(0, 0, 127, 499), "bench shelf", B_TITLED_WINDOW,
+			B_ASYNCHRONOUS_CONTROLS),
+		fShelf(shelf)
+	{
+		auto dock = new DockListView<ShelfItem, int32, int32, Shelf>("dock", fShelf,
+			B_VERTICAL, mode);
+		auto scrollView = new BScrollView("scroll", dock, B_WILL_DRAW, false, true);
+		BLayoutBuilder::Group<>(this, B_VERTICAL, 0)
+			.Add(scrollView);
+	}
+
+	virtual void MessageReceived(BMessage* message) override
+	{
+		switch (message->what) {
+			case kMsgFill:
+				for (int32 item = 0; item < kShelfSize; item++)
+					fShelf->Insert(item, item);
+				break;
+			case kMsgEraseAll:
+				for (int32 item = 0; item < kShelfSize; item++)
+					fShelf->Erase(item);
+				break;
+			case kMsgClear:
+				fShelf->Clear();
+				break;
+			case kMsgSync:
+				break;
+			default:
+				BWindow::MessageReceived(message);
+				return;
+		}
+		message->SendReply(message->what);
+	}
+
+private:
+	Shelf*					fShelf;
+};
+
+
+// Returns once the window handled everything queued before, including the
+// layout passes the dock posts to itself on the way
+static void
+Sync(const BMessenger& window)
+{
+	for (int32 round = 0; round < 2; round++) {
+		BMessage reply;
+		window.SendMessage(kMsgSync, &reply);
+	}
+}
+
+
+static bigtime_t
+TimeEmptying(const BMessenger& window, uint32 what)
+{
+	BMessage reply;
+	window.SendMessage(kMsgFill, &reply);
+	Sync(window);
+
+	bigtime_t start = system_time();
+	window.SendMessage(what, &reply);
+	Sync(window);
+	return system_time() - start;
+}
+
+
+static void
+RunShelf(const char* name, dock_list_mode mode)
+{
+	Shelf* shelf = new Shelf();
+	ShelfWindow* window = new ShelfWindow(shelf, mode);
+	window->Show();
+	BMessenger messenger(window);
+
+	char variant[64];
+	snprintf(variant, sizeof(variant), "%s, erase %" B_PRId32 " one by one", name,
+		kShelfSize);
+	Report("shelf", variant, TimeEmptying(messenger, kMsgEraseAll), "us");
+	snprintf(variant, sizeof(variant), "%s, clear %" B_PRId32, name, kShelfSize);
+	Report("shelf", variant, TimeEmptying(messenger, kMsgClear), "us");
+
+	if (window->Lock())
+		window->Quit();
+	delete shelf;
+}
+
+
+void
+RunShelfBench()
+{
+	RunShelf("all views", DOCK_LIST_ALL_VIEWS);
+	RunShelf("virtual", DOCK_LIST_VIRTUAL);
+}
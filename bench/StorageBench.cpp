@@ -0,0 +1,101 @@
+/*
+ * Copyright 2024, Nexus6 <nexus6@disroot.org>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+// Inserting, finding and erasing random 36 character keys, like the
+// negotiation IDs, in each ObservableMap storage policy and the
+// SequenceStorage of ObservableSequence, with 10, 1000 and 100000 items.
+// All three go through the keys in another random order.
+
+#include "Bench.h"
+
+#include "interface/ObservableMap.hpp"
+#include "interface/ObservableSequence.hpp"
+
+#include <String.h>
+
+#include <random>
+
+
+using Observable::FlatStorage;
+using Observable::HashStorage;
+using Observable::LinkedStorage;
+using Observable::OrderedStorage;
+using Observable::SequenceStorage;
+
+// Each size is measured on this many items overall, in as many rounds
+static const int32 kItemsPerSize = 200000;
+
+
+template<template<typename, typename> class Storage>
+static void
+RunStorage(const char* name, const std::vector<BString>& keys,
+	const std::vector<BString>& lookups)
+{
+	typedef Storage<BString, int32> storage_type;
+
+	int32 count = keys.size();
+	int32 rounds = std::max((int32)1, kItemsPerSize / count);
+	bigtime_t inserting = 0;
+	bigtime_t finding = 0;
+	bigtime_t erasing = 0;
+	int32 found = 0;
+
+	for (int32 round = 0; round < rounds; round++) {
+		storage_type storage;
+
+		bigtime_t start = system_time();
+		for (int32 index = 0; index < count; index++)
+			storage.insert_or_assign(keys[index], index);
+		inserting += system_time() - start;
+
+		start = system_time();
+		for (const BString& key : lookups)
+			found += storage.find(key) != storage.end();
+		finding += system_time() - start;
+
+		start = system_time();
+		for (const BString& key : lookups)
+			storage.erase(key);
+		erasing += system_time() - start;
+	}
+
+	if (found != count * rounds)
+		printf("storage: %s lost items\n", name);
+
+	double operations = double(count) * rounds / 1000;
+	char variant[64];
+	snprintf(variant, sizeof(variant), "%s, %" B_PRId32 ", insert", name, count);
+	Report("storage", variant, inserting / operations, "ns/op");
+	snprintf(variant, sizeof(variant), "%s, %" B_PRId32 ", find", name, count);
+	Report("storage", variant, finding / operations, "ns/op");
+	snprintf(variant, sizeof(variant), "%s, %" B_PRId32 ", erase", name, count);
+	Report("storage", variant, erasing / operations, "ns/op");
+}
+
+
+void
+RunStorageBench()
+{
+	std::mt19937 random(2024);
+	const int32 kSizes[] = { 10, 1000, 100000 };
+
+	for (int32 count : kSizes) {
+		std::vector<BString> keys(count);
+		for (BString& key : keys) {
+			key.SetToFormat("%08" B_PRIx32 "-%04" B_PRIx32 "-4%03" B_PRIx32 "-8%03" B_PRIx32
+				"-%04" B_PRIx32 "%08" B_PRIx32, (uint32)random(), (uint32)random() & 0xffff,
+				(uint32)random() & 0xfff, (uint32)random() & 0xfff, (uint32)random() & 0xffff,
+				(uint32)random());
+		}
+		std::vector<BString> lookups(keys);
+		std::shuffle(lookups.begin(), lookups.end(), random);
+
+		RunStorage<OrderedStorage>("ordered", keys, lookups);
+		RunStorage<HashStorage>("hash", keys, lookups);
+		RunStorage<FlatStorage>("flat", keys, lookups);
+		RunStorage<LinkedStorage>("linked", keys, lookups);
+		RunStorage<SequenceStorage>("sequence", keys, lookups);
+	}
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2024, Nexus6 <nexus6@disroot.org>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+// Tasks per second from Run() until the looper got the result, on the
+// shared executor against a thread spawned for every task.
+
+#include "Bench.h"
+
+#include "interface/Task.hpp"
+
+#include <Looper.h>
+#include <Message.h>
+#include <Messenger.h>
+
+
+using Genio::Task::Task;
+using Genio::Task::TaskResult;
+using Genio::Task::TASK_RESULT_MESSAGE;
+using Genio::Task::dedicated_thread;
+
+static const int32 kTaskCount = 5000;
+
+
+class ResultCounter: public BLooper {
+public:
+	ResultCounter(int32 count)
+		:
+		BLooper("bench results"),
+		fCount(count),
+		fReceived(0),
+		fDone(create_sem(0, "bench tasks done"))
+	{
+	}
+
+	virtual ~ResultCounter()
+	{
+		delete_sem(fDone);
+	}
+
+	virtual void MessageReceived(BMessage* message) override
+	{
+		if (message->what != TASK_RESULT_MESSAGE) {
+			BLooper::MessageReceived(message);
+			return;
+		}
+
+		TaskResult<int32> result(message);
+		result.GetResult();
+		if (++fReceived == fCount)
+			release_sem(fDone);
+	}
+
+	sem_id Done() const { return fDone; }
+
+private:
+	int32					fCount;
+	int32					fReceived;
+	sem_id					fDone;
+};
+
+
+template<typename Start>
+static void
+RunTasks(const char* variant, Start start)
+{
+	ResultCounter* counter = new ResultCounter(kTaskCount);
+	counter->Run();
+	BMessenger messenger(counter);
+
+	bigtime_t startTime = system_time();
+	for (int32 index = 0; index < kTaskCount; index++)
+		start(messenger, index);
+	status_t status = acquire_sem_etc(counter->Done(), 1, B_RELATIVE_TIMEOUT, 60000000);
+	bigtime_t total = system_time() - startTime;
+
+	if (status == B_OK)
+		Report("tasks", variant, kTaskCount * 1000000.0 / total, "tasks/s");
+	else
+		Report("tasks", variant, 0, "timed out");
+
+	if (counter->Lock())
+		counter->Quit();
+}
+
+
+void
+RunTaskBench()
+{
+	RunTasks("executor", [](const BMessenger& messenger, int32 index) {
+		Task<int32> task("bench", messenger, [](int32 value) { return value; }, index);
+		task.Run();
+	});
+	RunTasks("thread per task", [](const BMessenger& messenger, int32 index) {
+		Task<int32> task(dedicated_thread, "bench", messenger,
+			[](int32 value) { return value; }, index);
+		task.Run();
+	});
+}
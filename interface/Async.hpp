@@ -0,0 +1,385 @@
+/*
+ * Copyright 2024, Nexus6 <nexus6@disroot.org>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#pragma once
+
+#include <Handler.h>
+#include <Looper.h>
+#include <Message.h>
+#include <Messenger.h>
+#include <OS.h>
+
+#include "DeadlineQueue.hpp"
+
+#include <coroutine>
+#include <cstdio>
+#include <exception>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+// Coroutines resumed on a looper thread.
+//
+// Example:
+//	Async
+//	Ping(AsyncDispatcher* dispatcher, BMessenger target)
+//	{
+//		BMessage ping('ping');
+//		AsyncReply reply = co_await dispatcher->SendAndAwaitReply(target, ping, 1000000);
+//		if (reply.status == B_OK)
+//			reply.message.PrintToStream();
+//	}
+//
+// The AsyncDispatcher must be added to the looper the coroutine should run
+// on; replies, retries and timeouts are all delivered to it as messages, so
+// no helper thread is involved and a pending await costs one map entry.
+
+namespace Genio::Task {
+
+	using namespace std;
+
+	const int ASYNC_TIMEOUT_MESSAGE = 'asto';
+
+	// Fire and forget coroutine: runs until its first co_await right away
+	// and frees itself when it returns.
+	class Async {
+	public:
+		struct promise_type {
+			Async get_return_object() { return Async(); }
+			suspend_never initial_suspend() noexcept { return {}; }
+			suspend_never final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception()
+			{
+				try {
+					rethrow_exception(current_exception());
+				} catch (const exception& e) {
+					printf("Async: unhandled exception: %s\n", e.what());
+				} catch (...) {
+					printf("Async: unhandled exception\n");
+				}
+			}
+		};
+	};
+
+
+	struct AsyncReply {
+		// B_OK if a reply arrived, B_TIMED_OUT or the send error otherwise
+		status_t	status;
+		BMessage	message;
+	};
+
+
+	class AsyncDispatcher : public BHandler {
+	public:
+		class ReplyAwaiter;
+		class DeliveryAwaiter;
+
+								AsyncDispatcher(const char* name = "async dispatcher");
+		virtual					~AsyncDispatcher();
+
+		virtual void			MessageReceived(BMessage* message) override;
+
+		// Tags the message and waits for a reply to it; the caller sends it
+		// itself (e.g. with BView::DragMessage()) using this dispatcher as
+		// the reply handler.
+		ReplyAwaiter			AwaitReply(BMessage* message, bigtime_t timeout,
+									const void* owner = nullptr);
+
+		// Sends the message to target and waits for its reply.
+		ReplyAwaiter			SendAndAwaitReply(const BMessenger& target,
+									const BMessage& message, bigtime_t timeout,
+									const void* owner = nullptr);
+
+		// Sends the message without ever blocking the looper: while the
+		// target port is full, sending is retried until the timeout.
+		DeliveryAwaiter			AwaitDelivery(const BMessenger& target,
+									const BMessage& message, bigtime_t timeout,
+									const void* owner = nullptr);
+
+		// Destroys the coroutines waiting on behalf of owner, the one given
+		// to the Await calls, without resuming them. For coroutines that
+		// use an object the owner is about to delete.
+		void					Cancel(const void* owner);
+
+		auto					CountPending() const { return fPending.size(); }
+
+	private:
+		struct Pending {
+			coroutine_handle<>	handle;
+			status_t*			status;
+			BMessage*			reply;		// awaited reply, or
+			BMessage*			message;	// message waiting to be delivered
+			BMessenger			target;
+			bigtime_t			deadline;
+			const void*			owner;
+		};
+
+		int64					_Register(const Pending& pending);
+		void					_Resume(int64 token, status_t status);
+		void					_Expired(int64 token);
+
+		static constexpr const char* kTokenField = "genio:async_token";
+		static constexpr bigtime_t kRetryInterval = 10000;
+
+		map<int64, Pending>		fPending;
+		int64					fNextToken;
+		DeadlineQueue<int64>	fDeadlines;
+		bool					fHasTarget;
+	};
+
+
+	class AsyncDispatcher::ReplyAwaiter {
+	public:
+		ReplyAwaiter(AsyncDispatcher* dispatcher, BMessage* message,
+			const BMessenger& target, bigtime_t timeout, const void* owner)
+			:
+			fDispatcher(dispatcher),
+			fMessage(message),
+			fTarget(target),
+			fTimeout(timeout),
+			fOwner(owner)
+		{
+			fReply.status = B_TIMED_OUT;
+		}
+
+		bool await_ready() const noexcept { return false; }
+
+		bool await_suspend(coroutine_handle<> handle)
+		{
+			Pending pending = { handle, &fReply.status, &fReply.message, nullptr,
+				fTarget, system_time() + fTimeout, fOwner };
+			int64 token = fDispatcher->_Register(pending);
+			BMessage* message = fMessage != nullptr ? fMessage : &fOwnMessage;
+			message->RemoveName(kTokenField);
+			message->AddInt64(kTokenField, token);
+
+			if (!fTarget.IsValid())
+				return true;
+
+			status_t status = fTarget.SendMessage(message, fDispatcher, 0);
+			if (status == B_OK)
+				return true;
+
+			// don't suspend, report the send error right away
+			fDispatcher->fDeadlines.Cancel(token);
+			fDispatcher->fPending.erase(token);
+			fReply.status = status;
+			return false;
+		}
+
+		AsyncReply await_resume() { return std::move(fReply); }
+
+	private:
+		AsyncDispatcher*		fDispatcher;
+		BMessage*				fMessage;
+		BMessage				fOwnMessage;
+			// sent instead when fMessage is NULL
+		BMessenger				fTarget;
+		bigtime_t				fTimeout;
+		const void*				fOwner;
+		AsyncReply				fReply;
+
+		friend class AsyncDispatcher;
+	};
+
+
+	class AsyncDispatcher::DeliveryAwaiter {
+	public:
+		DeliveryAwaiter(AsyncDispatcher* dispatcher, const BMessenger& target,
+			const BMessage& message, bigtime_t timeout, const void* owner)
+			:
+			fDispatcher(dispatcher),
+			fTarget(target),
+			fMessage(message),
+			fTimeout(timeout),
+			fOwner(owner),
+			fStatus(B_ERROR)
+		{
+		}
+
+		bool await_ready()
+		{
+			fStatus = fTarget.SendMessage(&fMessage, (BHandler*)NULL, 0);
+			return fStatus != B_WOULD_BLOCK;
+		}
+
+		void await_suspend(coroutine_handle<> handle)
+		{
+			Pending pending = { handle, &fStatus, nullptr, &fMessage, fTarget,
+				system_time() + fTimeout, fOwner };
+			fDispatcher->_Register(pending);
+		}
+
+		status_t await_resume() const { return fStatus; }
+
+	private:
+		AsyncDispatcher*		fDispatcher;
+		BMessenger				fTarget;
+		BMessage				fMessage;
+		bigtime_t				fTimeout;
+		const void*				fOwner;
+		status_t				fStatus;
+	};
+
+
+	inline
+	AsyncDispatcher::AsyncDispatcher(const char* name)
+		:
+		BHandler(name),
+		fNextToken(0),
+		fDeadlines(ASYNC_TIMEOUT_MESSAGE),
+		fHasTarget(false)
+	{
+	}
+
+
+	inline
+	AsyncDispatcher::~AsyncDispatcher()
+	{
+		// the coroutines can't be resumed anymore, free their frames
+		for (auto& [token, pending] : fPending)
+			pending.handle.destroy();
+	}
+
+
+	inline void
+	AsyncDispatcher::MessageReceived(BMessage* message)
+	{
+		if (message->IsReply()) {
+			const BMessage* previous = message->Previous();
+			int64 token = previous != nullptr ? previous->GetInt64(kTokenField, -1) : -1;
+			auto it = fPending.find(token);
+			if (it != fPending.end() && it->second.reply != nullptr) {
+				*it->second.reply = *message;
+				_Resume(token, B_OK);
+				return;
+			}
+		}
+
+		switch (message->what) {
+			case ASYNC_TIMEOUT_MESSAGE: {
+				fDeadlines.Expire([this](const int64& token) {
+					_Expired(token);
+				});
+				break;
+			}
+			default:
+				BHandler::MessageReceived(message);
+		}
+	}
+
+
+	inline AsyncDispatcher::ReplyAwaiter
+	AsyncDispatcher::AwaitReply(BMessage* message, bigtime_t timeout, const void* owner)
+	{
+		return ReplyAwaiter(this, message, BMessenger(), timeout, owner);
+	}
+
+
+	inline AsyncDispatcher::ReplyAwaiter
+	AsyncDispatcher::SendAndAwaitReply(const BMessenger& target, const BMessage& message,
+		bigtime_t timeout, const void* owner)
+	{
+		ReplyAwaiter awaiter(this, nullptr, target, timeout, owner);
+		awaiter.fOwnMessage = message;
+		return awaiter;
+	}
+
+
+	inline AsyncDispatcher::DeliveryAwaiter
+	AsyncDispatcher::AwaitDelivery(const BMessenger& target, const BMessage& message,
+		bigtime_t timeout, const void* owner)
+	{
+		return DeliveryAwaiter(this, target, message, timeout, owner);
+	}
+
+
+	inline void
+	AsyncDispatcher::Cancel(const void* owner)
+	{
+		if (owner == nullptr)
+			return;
+
+		vector<coroutine_handle<> > cancelled;
+		for (auto it = fPending.begin(); it != fPending.end();) {
+			if (it->second.owner != owner) {
+				++it;
+				continue;
+			}
+			fDeadlines.Cancel(it->first);
+			cancelled.push_back(it->second.handle);
+			it = fPending.erase(it);
+		}
+
+		// a frame going away may cancel further coroutines
+		for (coroutine_handle<>& handle : cancelled)
+			handle.destroy();
+	}
+
+
+	inline int64
+	AsyncDispatcher::_Register(const Pending& pending)
+	{
+		if (!fHasTarget) {
+			if (Looper() == nullptr)
+				throw runtime_error("AsyncDispatcher is not attached to a looper");
+			fDeadlines.SetTarget(BMessenger(this));
+			fHasTarget = true;
+		}
+
+		int64 token = fNextToken++;
+		fPending[token] = pending;
+		if (pending.message != nullptr)
+			fDeadlines.Schedule(token, system_time() + kRetryInterval);
+		else
+			fDeadlines.Schedule(token, pending.deadline);
+		return token;
+	}
+
+
+	inline void
+	AsyncDispatcher::_Resume(int64 token, status_t status)
+	{
+		auto it = fPending.find(token);
+		if (it == fPending.end())
+			return;
+
+		// the coroutine may await again, so forget about it before resuming
+		Pending pending = it->second;
+		fPending.erase(it);
+		fDeadlines.Cancel(token);
+
+		*pending.status = status;
+		pending.handle.resume();
+	}
+
+
+	inline void
+	AsyncDispatcher::_Expired(int64 token)
+	{
+		auto it = fPending.find(token);
+		if (it == fPending.end())
+			return;
+
+		Pending& pending = it->second;
+		if (pending.message == nullptr) {
+			_Resume(token, B_TIMED_OUT);
+			return;
+		}
+
+		status_t status = pending.target.SendMessage(pending.message, (BHandler*)NULL, 0);
+		if (status != B_WOULD_BLOCK) {
+			_Resume(token, status);
+			return;
+		}
+
+		bigtime_t now = system_time();
+		if (now >= pending.deadline)
+			_Resume(token, B_TIMED_OUT);
+		else
+			fDeadlines.Schedule(token, min(now + kRetryInterval, pending.deadline));
+	}
+}
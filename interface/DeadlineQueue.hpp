@@ -0,0 +1,206 @@
+/*
+ * Copyright 2024, Nexus6 <nexus6@disroot.org>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#pragma once
+
+#include <Message.h>
+#include <MessageRunner.h>
+#include <Messenger.h>
+#include <OS.h>
+#include <SupportDefs.h>
+
+#include <functional>
+#include <map>
+#include <queue>
+#include <vector>
+
+
+// Keeps one deadline per key and drives all of them from a single
+// BMessageRunner. The runner is always armed for the earliest deadline and
+// delivers a message with the given what to the target; the target then
+// calls Expire() to collect the keys whose deadline has passed.
+//
+// Rescheduling or cancelling a key leaves a stale heap entry behind, which
+// is skipped when it surfaces (lazy deletion).
+template<typename Key>
+class DeadlineQueue {
+public:
+									DeadlineQueue(uint32 what);
+									~DeadlineQueue();
+
+	void							SetTarget(const BMessenger& target);
+
+	void							Schedule(const Key& key, bigtime_t deadline);
+	bool							Cancel(const Key& key);
+	bool							IsScheduled(const Key& key) const;
+	auto							Size() const { return fGenerations.size(); }
+
+	void							Expire(std::function<void(const Key&)> expired);
+
+private:
+	struct Entry {
+		bigtime_t					deadline;
+		uint64						generation;
+		Key							key;
+
+		bool operator>(const Entry& other) const
+		{
+			return deadline > other.deadline;
+		}
+	};
+
+	typedef std::priority_queue<Entry, std::vector<Entry>,
+		std::greater<Entry> > EntryHeap;
+
+	EntryHeap						fHeap;
+	std::map<Key, uint64>			fGenerations;
+	uint64							fNextGeneration;
+
+	BMessenger						fTarget;
+	uint32							fWhat;
+	BMessageRunner*					fRunner;
+	bigtime_t						fArmedDeadline;
+
+	bool							_IsLive(const Entry& entry) const;
+	void							_DropStale();
+	void							_Rearm();
+};
+
+
+template<typename Key>
+DeadlineQueue<Key>::DeadlineQueue(uint32 what)
+	:
+	fNextGeneration(0),
+	fWhat(what),
+	fRunner(nullptr),
+	fArmedDeadline(B_INFINITE_TIMEOUT)
+{
+}
+
+
+template<typename Key>
+DeadlineQueue<Key>::~DeadlineQueue()
+{
+	delete fRunner;
+}
+
+
+template<typename Key>
+void
+DeadlineQueue<Key>::SetTarget(const BMessenger& target)
+{
+	fTarget = target;
+}
+
+
+template<typename Key>
+void
+DeadlineQueue<Key>::Schedule(const Key& key, bigtime_t deadline)
+{
+	uint64 generation = fNextGeneration++;
+	fGenerations[key] = generation;
+	fHeap.push(Entry{deadline, generation, key});
+
+	// compact the heap when rescheduling left too many stale entries
+	if (fHeap.size() > 2 * fGenerations.size() + 64) {
+		EntryHeap heap;
+		while (!fHeap.empty()) {
+			if (_IsLive(fHeap.top()))
+				heap.push(fHeap.top());
+			fHeap.pop();
+		}
+		fHeap.swap(heap);
+	}
+
+	_Rearm();
+}
+
+
+template<typename Key>
+bool
+DeadlineQueue<Key>::Cancel(const Key& key)
+{
+	bool erased = fGenerations.erase(key) > 0;
+	if (erased)
+		_Rearm();
+	return erased;
+}
+
+
+template<typename Key>
+bool
+DeadlineQueue<Key>::IsScheduled(const Key& key) const
+{
+	return fGenerations.find(key) != fGenerations.end();
+}
+
+
+template<typename Key>
+void
+DeadlineQueue<Key>::Expire(std::function<void(const Key&)> expired)
+{
+	// the runner fired (or is about to), it will be re-created if needed
+	delete fRunner;
+	fRunner = nullptr;
+	fArmedDeadline = B_INFINITE_TIMEOUT;
+
+	// collect first, the callback is allowed to reschedule keys
+	std::vector<Key> keys;
+	bigtime_t now = system_time();
+	_DropStale();
+	while (!fHeap.empty() && fHeap.top().deadline <= now) {
+		keys.push_back(fHeap.top().key);
+		fGenerations.erase(fHeap.top().key);
+		fHeap.pop();
+		_DropStale();
+	}
+
+	for (const Key& key : keys)
+		expired(key);
+
+	_Rearm();
+}
+
+
+template<typename Key>
+bool
+DeadlineQueue<Key>::_IsLive(const Entry& entry) const
+{
+	auto it = fGenerations.find(entry.key);
+	return it != fGenerations.end() && it->second == entry.generation;
+}
+
+
+template<typename Key>
+void
+DeadlineQueue<Key>::_DropStale()
+{
+	while (!fHeap.empty() && !_IsLive(fHeap.top()))
+		fHeap.pop();
+}
+
+
+template<typename Key>
+void
+DeadlineQueue<Key>::_Rearm()
+{
+	_DropStale();
+	if (fHeap.empty()) {
+		delete fRunner;
+		fRunner = nullptr;
+		fArmedDeadline = B_INFINITE_TIMEOUT;
+		return;
+	}
+
+	bigtime_t deadline = fHeap.top().deadline;
+	if (fRunner != nullptr && fArmedDeadline == deadline)
+		return;
+
+	delete fRunner;
+	BMessage message(fWhat);
+	bigtime_t delay = deadline - system_time();
+	fRunner = new BMessageRunner(fTarget, &message, delay > 0 ? delay : 1, 1);
+	fArmedDeadline = deadline;
+}
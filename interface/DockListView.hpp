@@ -6,13 +6,21 @@
 #pragma once
 
 #include "interface/ObservableMap.hpp"
+#include "interface/ObservableSequence.hpp"
+#include <Bitmap.h>
 #include <Button.h>
+#include <ControlLook.h>
 #include <LayoutBuilder.h>
 #include <SupportDefs.h>
 #include <ListItem.h>
 #include <ScrollView.h>
 #include <View.h>
 
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <vector>
+
 
 using Observable::ObservableMap;
 
@@ -41,130 +49,326 @@ DockListItem<Item>::~DockListItem()
 }
 
 
+enum dock_list_mode {
+	DOCK_LIST_ALL_VIEWS,	// one view per item, placed by a group layout
+	DOCK_LIST_VIRTUAL,		// views for the visible items only, recycled on
+							// scrolling; T needs a SetItem(Value) method
+	DOCK_LIST_FLYWEIGHT		// no item views at all, the dock draws the items
+							// and starts drags through static methods of T:
+							// DescribeItem(Value, dock_item_record*),
+							// StartDrag(BView*, Value, BRect) and
+							// EndDrag(BView*, Value)
+};
+
+
+// What the dock draws for one item in flyweight mode: the icon with the
+// label centered below it. The frame follows from the item's position.
+struct dock_item_record {
+	const BBitmap*	icon;
+	BString			label;
+	BString			truncatedLabel;
+	float			truncatedWidth;
+		// the label got truncated for this width, < 0 if not yet
+};
+
+
+// In virtual and flyweight mode all items are expected to be as large as
+// the first one and are placed in insertion order.
+// The data source is an ObservableMap or an ObservableSequence, items of a
+// sequence are inserted, removed and moved at the positions its notices
+// tell.
 // template<Derived<DockListItem> T, typename Key, typename Value>
-template<typename T, typename Key, typename Value>
+template<typename T, typename Key, typename Value,
+	typename Source = ObservableMap<Key, Value> >
 class DockListView: public BView {
 public:
 									DockListView(const char* name,
-										ObservableMap<Key, Value>* dataSource,
-										orientation orientation = B_VERTICAL);
+										Source* dataSource,
+										orientation orientation = B_VERTICAL,
+										dock_list_mode mode = DOCK_LIST_ALL_VIEWS);
 	virtual							~DockListView();
 
-	void 							SetDataSource(ObservableMap<Key, Value>* dataSource);
+	void 							SetDataSource(Source* dataSource);
 
-	virtual void 					Draw(BRect updateRect) override;
 	virtual void 					AttachedToWindow() override;
+	virtual void 					DetachedFromWindow() override;
+	virtual void 					Draw(BRect updateRect) override;
+	virtual	void					MouseDown(BPoint where) override;
+	virtual	void					MouseUp(BPoint where) override;
 	virtual void 					TargetedByScrollView(BScrollView* scrollView) override;
 	virtual void					MessageReceived(BMessage* message) override;
 	virtual void					ScrollTo(BPoint point) override;
+	virtual void					FrameResized(float width, float height) override;
 
 private:
-		ObservableMap<Key, Value>*	fDataSource;
+		static const uint32			kMsgRedoLayout = 'rdlo';
+		static const int32			kOverscan = 2;
+		static constexpr float		kInset = 10;
+
+		Source*						fDataSource;
 		BLayoutBuilder::Group<>		fLayout;
 		BScrollView*				fScrollView;
+		std::map<Key, T*>			fViews;
+			// every item view, or only the bound ones in virtual mode
+
+		orientation					fOrientation;
+		dock_list_mode				fMode;
+		Observable::SequenceStorage<Key, dock_item_record> fRows;
+			// virtual and flyweight mode, the records are for the latter
+		std::vector<T*>				fSpareViews;
+		BSize						fItemSize;
+			// unset until _MeasureItems() measured the first item
+		float						fSpacing;
+		bool						fLayoutScheduled;
+
+		float						fLabelHeight;
+		int32						fDirtyFrom;
+			// first item to redraw with the next layout pass
+		bool						fDragging;
+		Key							fDragKey;
+		int64						fVersion;
+			// of the data source the items are in sync with, < 0 if none
 
 		void						_InitData();
+		void						_StopWatching();
+		void						_ApplyChanges(const BMessage* changes);
+		void						_AddItem(const Key& key, const Value& value,
+										int32 index = -1);
+		void						_RemoveItem(const Key& key, int32 index = -1);
+		void						_MoveItem(const Key& key, int32 from, int32 to);
+		void						_AddItems(const std::vector<Key>& keys);
+		void						_RemoveItems(const std::vector<Key>& keys);
+		void						_RemoveAllItems();
+		void						_UpdateVisibleItems();
+		T*							_AcquireView(const Value& value);
+		void						_RecycleView(T* view);
+		void						_MeasureItems();
+		float						_Pitch() const;
+		BRect						_ItemFrame(int32 index) const;
+		void						_ItemRange(BRect area, int32 overscan,
+										int32* first, int32* last) const;
+		int32						_ItemAt(BPoint where) const;
+		float						_ContentExtent();
 		void						_FixupScrollBar();
+		void						_ScheduleLayout();
 		void						_RedoLayout();
 };
 
 
-template<typename T, typename Key, typename Value>
-DockListView<T, Key, Value>::DockListView(const char* name,
-								ObservableMap<Key, Value>* dataSource,
-								orientation orientation)
+template<typename T, typename Key, typename Value, typename Source>
+DockListView<T, Key, Value, Source>::DockListView(const char* name,
+								Source* dataSource,
+								orientation orientation,
+								dock_list_mode mode)
 	: BView(name, B_WILL_DRAW | B_FRAME_EVENTS | B_SCROLL_VIEW_AWARE),
-	fDataSource(dataSource)
+	fDataSource(dataSource),
+	fOrientation(orientation),
+	fMode(mode),
+	fItemSize(),
+	fSpacing(BControlLook::ComposeSpacing(B_USE_SMALL_SPACING)),
+	fLayoutScheduled(false),
+	fLabelHeight(0),
+	fDirtyFrom(INT32_MAX),
+	fDragging(false),
+	fVersion(-1)
 {
+	// the other modes place the items themselves
+	if (fMode != DOCK_LIST_ALL_VIEWS)
+		return;
+
 	(fLayout = BLayoutBuilder::Group<>(this, orientation, B_USE_SMALL_SPACING))
-		.SetInsets(10, 10, 10, 10)
+		.SetInsets(kInset, kInset, kInset, kInset)
 		.SetExplicitAlignment(BAlignment(B_ALIGN_HORIZONTAL_CENTER, B_ALIGN_MIDDLE));
 		// .AddGlue();
 }
 
 
-template<typename T, typename Key, typename Value>
-DockListView<T, Key, Value>::~DockListView()
+template<typename T, typename Key, typename Value, typename Source>
+DockListView<T, Key, Value, Source>::~DockListView()
 {
+	// spare views are hidden children, BView deletes them with the others
 }
 
 
-template<typename T, typename Key, typename Value>
+template<typename T, typename Key, typename Value, typename Source>
 void
-DockListView<T, Key, Value>::AttachedToWindow()
+DockListView<T, Key, Value, Source>::AttachedToWindow()
 {
 	BView::AttachedToWindow();
 	_InitData();
 }
 
 
-template<typename T, typename Key, typename Value>
+// The items stay, once attached again only the changes made in between
+// are applied.
+template<typename T, typename Key, typename Value, typename Source>
 void
-DockListView<T, Key, Value>::Draw(BRect updateRect)
+DockListView<T, Key, Value, Source>::DetachedFromWindow()
 {
-	auto bounds = fLayout.View()->Bounds();
-	SetExplicitSize(bounds.Size());
+	if (fDataSource != nullptr)
+		_StopWatching();
+	BView::DetachedFromWindow();
 }
 
 
-template<typename T, typename Key, typename Value>
+template<typename T, typename Key, typename Value, typename Source>
 void
-DockListView<T, Key, Value>::SetDataSource(ObservableMap<Key, Value>* dataSource)
+DockListView<T, Key, Value, Source>::Draw(BRect updateRect)
 {
-	for (int i = 0; i < CountChildren(); i++)
-		RemoveChild(ChildAt(i));
+	if (fMode != DOCK_LIST_FLYWEIGHT || !fItemSize.IsWidthSet())
+		return;
+
+	SetDrawingMode(B_OP_ALPHA);
+	int32 first, last;
+	_ItemRange(updateRect, 0, &first, &last);
+	auto row = fRows.at_index(first);
+	for (int32 index = first; index <= last; index++, ++row) {
+		dock_item_record& record = row->second;
+		BRect frame = _ItemFrame(index);
+		float iconHeight = 0;
+		if (record.icon != nullptr) {
+			DrawBitmap(record.icon, frame.LeftTop());
+			iconHeight = record.icon->Bounds().Height();
+		}
+
+		if (record.truncatedWidth != frame.Width()) {
+			record.truncatedLabel = record.label;
+			TruncateString(&record.truncatedLabel, B_TRUNCATE_MIDDLE, frame.Width());
+			record.truncatedWidth = frame.Width();
+		}
+		float labelWidth = StringWidth(record.truncatedLabel);
+		DrawString(record.truncatedLabel, BPoint(frame.left + (frame.Width() - labelWidth) / 2,
+			frame.top + iconHeight + fLabelHeight));
+	}
+}
+
+
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::MouseDown(BPoint where)
+{
+	if (fMode != DOCK_LIST_FLYWEIGHT) {
+		BView::MouseDown(where);
+		return;
+	}
+
+	int32 index = _ItemAt(where);
+	if (index < 0)
+		return;
+	const Key& key = fRows.item_at(index).first;
+	auto entry = fDataSource->Find(key);
+	if (entry == fDataSource->end())
+		return;
+
+	SetMouseEventMask(B_POINTER_EVENTS, 0);
+	T::StartDrag(this, entry->second, _ItemFrame(index));
+	fDragKey = key;
+	fDragging = true;
+}
+
+
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::MouseUp(BPoint where)
+{
+	if (fMode != DOCK_LIST_FLYWEIGHT) {
+		BView::MouseUp(where);
+		return;
+	}
+
+	if (fDragging) {
+		auto entry = fDataSource->Find(fDragKey);
+		if (entry != fDataSource->end())
+			T::EndDrag(this, entry->second);
+	}
+	fDragging = false;
+}
+
+
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::SetDataSource(Source* dataSource)
+{
+	if (fDataSource != nullptr)
+		_StopWatching();
+	_RemoveAllItems();
 	fDataSource = dataSource;
+	fVersion = -1;
 	_InitData();
 }
 
 
-template<typename T, typename Key, typename Value>
+template<typename T, typename Key, typename Value, typename Source>
 void
-DockListView<T, Key, Value>::TargetedByScrollView(BScrollView* scrollView)
+DockListView<T, Key, Value, Source>::TargetedByScrollView(BScrollView* /*scrollView*/)
 {
 	// BView::TargetedByScrollView(scrollView);
 	// _FixupScrollBar();
 }
 
 
-template<typename T, typename Key, typename Value>
+template<typename T, typename Key, typename Value, typename Source>
 void
-DockListView<T, Key, Value>::MessageReceived(BMessage* message)
+DockListView<T, Key, Value, Source>::MessageReceived(BMessage* message)
 {
 	switch(message->what) {
-		case 'rdlo': {
-			printf("Redo layout\n");
+		case kMsgRedoLayout: {
+			fLayoutScheduled = false;
 			_RedoLayout();
 			break;
 		}
 		case B_OBSERVER_NOTICE_CHANGE: {
+			// the change is part of the items we copied or caught up with
+			int64 version = message->GetInt64("version", -1);
+			if (version >= 0 && version <= fVersion)
+				break;
+			fVersion = std::max(fVersion, version);
+
 			int32 code;
 			message->FindInt32(B_OBSERVE_WHAT_CHANGE, &code);
 			switch (code) {
 				case Observable::ItemInserted: {
 					printf("Observable::ItemInserted\n");
-					// message->PrintToStream();
 					GMessage *msg = (GMessage *)message;
 					Key key = (*msg)["key"];
-					// printf("key = %s\n", key.String());
-					auto item = fDataSource->Get(key);
-					auto droppeditem = new T(item);
-					fLayout.Add(droppeditem);
-					// fLayout.AddGlue();
-					_RedoLayout();
+					// it may have been erased since
+					auto entry = fDataSource->Find(key);
+					if (entry == fDataSource->end())
+						break;
+					_AddItem(key, entry->second, message->GetInt32("index", -1));
+					_ScheduleLayout();
 					break;
 				}
 				case Observable::ItemErased: {
 					printf("Observable::ItemErased\n");
-					message->AddMessenger("sender", BMessenger(this));
-					message->RemoveData("be:observe_orig_what");
-					message->RemoveData("be:observe_change_what");
-					SendNotices(Observable::ItemErased, message);
+					GMessage *msg = (GMessage *)message;
+					Key key = (*msg)["key"];
+					_RemoveItem(key, message->GetInt32("index", -1));
+					_ScheduleLayout();
+					break;
+				}
+				case Observable::ItemMoved: {
+					GMessage *msg = (GMessage *)message;
+					Key key = (*msg)["key"];
+					_MoveItem(key, message->GetInt32("from", -1),
+						message->GetInt32("index", -1));
+					_ScheduleLayout();
+					break;
+				}
+				case Observable::ItemsCleared: {
+					_RemoveAllItems();
+					_ScheduleLayout();
+					break;
+				}
+				case Observable::ItemsChanged: {
+					_ApplyChanges(message);
+					_ScheduleLayout();
 					break;
 				}
 				default:
 					break;
 			}
+			break;
 		}
 		default:
 			BView::MessageReceived(message);
@@ -172,34 +376,454 @@ DockListView<T, Key, Value>::MessageReceived(BMessage* message)
 }
 
 
-template<typename T, typename Key, typename Value>
+template<typename T, typename Key, typename Value, typename Source>
 void
-DockListView<T, Key, Value>::ScrollTo(BPoint point)
+DockListView<T, Key, Value, Source>::ScrollTo(BPoint point)
 {
 	BView::ScrollTo(point);
+	if (fMode == DOCK_LIST_VIRTUAL)
+		_UpdateVisibleItems();
 }
 
 
-template<typename T, typename Key, typename Value>
+template<typename T, typename Key, typename Value, typename Source>
 void
-DockListView<T, Key, Value>::_InitData()
+DockListView<T, Key, Value, Source>::FrameResized(float width, float height)
+{
+	BView::FrameResized(width, height);
+	if (fMode == DOCK_LIST_ALL_VIEWS)
+		return;
+
+	// the items are centered across the orientation
+	fDirtyFrom = 0;
+	_RedoLayout();
+}
+
+
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::_InitData()
 {
 	// TODO: if StartWatching fails we need to notify the caller. Maybe raising an exception?
 	fDataSource->StartWatching(this, Observable::ItemInserted);
 	fDataSource->StartWatching(this, Observable::ItemErased);
 	fDataSource->StartWatching(this, Observable::ItemsCleared);
+	fDataSource->StartWatching(this, Observable::ItemsChanged);
+	fDataSource->StartWatching(this, Observable::ItemMoved);
+
+	if (fVersion >= 0) {
+		BMessage changes;
+		fDataSource->ChangesSince(fVersion, &changes);
+		_ApplyChanges(&changes);
+	} else {
+		for (auto it = fDataSource->begin(); it != fDataSource->end(); ++it)
+			_AddItem(it->first, it->second);
+	}
+	fVersion = fDataSource->Version();
+	_RedoLayout();
+}
+
+
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::_StopWatching()
+{
+	fDataSource->StopWatching(this, Observable::ItemInserted);
+	fDataSource->StopWatching(this, Observable::ItemErased);
+	fDataSource->StopWatching(this, Observable::ItemsCleared);
+	fDataSource->StopWatching(this, Observable::ItemsChanged);
+	fDataSource->StopWatching(this, Observable::ItemMoved);
+}
+
+
+// Applies an ItemsChanged message, be it a committed batch or what the
+// data source reports with ChangesSince()
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::_ApplyChanges(const BMessage* changes)
+{
+	if (changes->GetBool("cleared", false))
+		_RemoveAllItems();
+
+	GMessage* message = (GMessage*)changes;
+	std::vector<Key> erased = (*message)["erased"];
+	std::vector<Key> inserted = (*message)["inserted"];
+	_RemoveItems(erased);
+	_AddItems(inserted);
+}
+
+
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::_AddItem(const Key& key, const Value& value,
+	int32 index)
+{
+	if (fMode != DOCK_LIST_ALL_VIEWS) {
+		int32 position = fRows.index_of(key);
+		if (position < 0) {
+			// a negative index appends
+			position = index < 0 || index > fRows.size() ? fRows.size() : index;
+			fRows.insert_at(position, key, dock_item_record());
+			fDirtyFrom = std::min(fDirtyFrom, position);
+		}
+		// in virtual mode a view is bound once the item scrolls into sight,
+		// one already bound shows the new value
+		if (fMode == DOCK_LIST_VIRTUAL) {
+			auto view = fViews.find(key);
+			if (view != fViews.end())
+				view->second->SetItem(value);
+		} else {
+			dock_item_record& record = fRows.at(key);
+			record.icon = nullptr;
+			record.truncatedWidth = -1;
+			T::DescribeItem(value, &record);
+			fDirtyFrom = std::min(fDirtyFrom, position);
+		}
+		return;
+	}
 
-	for (auto it = fDataSource->begin(); it != fDataSource->end(); ++it) {
-		auto item = new T(it->second);
+	auto item = new T(value);
+	BGroupLayout* layout = fLayout.Layout();
+	auto existing = fViews.find(key);
+	if (existing != fViews.end()) {
+		// a new value for the key, the view takes the place of the old one
+		index = layout->IndexOfView(existing->second);
+		existing->second->RemoveSelf();
+		delete existing->second;
+	}
+	if (index >= 0 && index < layout->CountItems())
+		layout->AddView(index, item);
+	else
 		fLayout.Add(item);
+	fViews[key] = item;
+}
+
+
+// Removes the view of the erased item straight away; the index spares
+// broadcasting the erasure to every item view, the rows find its position
+// in logarithmic time.
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::_RemoveItem(const Key& key, int32 index)
+{
+	if (fMode != DOCK_LIST_ALL_VIEWS) {
+		index = fRows.index_of(key);
+		if (index >= 0) {
+			fRows.erase(key);
+			if (fMode == DOCK_LIST_FLYWEIGHT) {
+				// the following items move up
+				fDirtyFrom = std::min(fDirtyFrom, index);
+				if (fDragging && fDragKey == key)
+					fDragging = false;
+			}
+		}
+	}
+
+	auto it = fViews.find(key);
+	if (it == fViews.end())
+		return;
+
+	T* item = it->second;
+	fViews.erase(it);
+	if (fMode == DOCK_LIST_VIRTUAL) {
+		_RecycleView(item);
+		return;
+	}
+	item->RemoveSelf();
+	delete item;
+}
+
+
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::_MoveItem(const Key& key, int32 from, int32 to)
+{
+	if (fMode == DOCK_LIST_ALL_VIEWS) {
+		auto it = fViews.find(key);
+		BGroupLayout* layout = fLayout.Layout();
+		if (it == fViews.end() || to < 0 || to >= layout->CountItems())
+			return;
+		layout->RemoveView(it->second);
+		layout->AddView(to, it->second);
+		return;
+	}
+
+	// the dock may be out of step with the notice, like for one sent
+	// before _InitData() copied the items
+	from = fRows.index_of(key);
+	if (from < 0 || to < 0 || to >= fRows.size() || from == to)
+		return;
+
+	fRows.move(from, to);
+	fDirtyFrom = std::min(fDirtyFrom, std::min(from, to));
+}
+
+
+// New keys are appended
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::_AddItems(const std::vector<Key>& keys)
+{
+	for (const Key& key : keys) {
+		// it may have been erased since
+		auto entry = fDataSource->Find(key);
+		if (entry == fDataSource->end())
+			continue;
+
+		if (fMode == DOCK_LIST_ALL_VIEWS || fRows.find(key) != fRows.end()) {
+			_AddItem(key, entry->second);
+			continue;
+		}
+
+		dock_item_record record = dock_item_record();
+		if (fMode == DOCK_LIST_FLYWEIGHT) {
+			record.truncatedWidth = -1;
+			T::DescribeItem(entry->second, &record);
+			fDirtyFrom = std::min(fDirtyFrom, fRows.size());
+		}
+		fRows.insert_or_assign(key, record);
 	}
-	_RedoLayout();
 }
 
 
-template<typename T, typename Key, typename Value>
+template<typename T, typename Key, typename Value, typename Source>
 void
-DockListView<T, Key, Value>::_FixupScrollBar()
+DockListView<T, Key, Value, Source>::_RemoveItems(const std::vector<Key>& keys)
+{
+	if (fMode == DOCK_LIST_ALL_VIEWS) {
+		for (const Key& key : keys)
+			_RemoveItem(key);
+		return;
+	}
+
+	for (const Key& key : keys) {
+		int32 index = fRows.index_of(key);
+		if (index >= 0) {
+			fDirtyFrom = std::min(fDirtyFrom, index);
+			fRows.erase(key);
+		}
+		if (fDragging && fDragKey == key)
+			fDragging = false;
+
+		auto it = fViews.find(key);
+		if (it == fViews.end())
+			continue;
+		_RecycleView(it->second);
+		fViews.erase(it);
+	}
+}
+
+
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::_RemoveAllItems()
+{
+	for (auto& [key, item] : fViews) {
+		item->RemoveSelf();
+		delete item;
+	}
+	fViews.clear();
+
+	for (T* item : fSpareViews) {
+		item->RemoveSelf();
+		delete item;
+	}
+	fSpareViews.clear();
+	fRows.clear();
+	fDirtyFrom = 0;
+	fDragging = false;
+}
+
+
+// Binds views to the items within the visible part of the view plus
+// kOverscan items on either side and recycles all others.
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::_UpdateVisibleItems()
+{
+	if (fDataSource == nullptr || Window() == nullptr)
+		return;
+
+	_MeasureItems();
+	if (!fItemSize.IsWidthSet())
+		return;
+
+	int32 first, last;
+	_ItemRange(Bounds(), kOverscan, &first, &last);
+
+	// recycle the views that left the range first, so they can be reused
+	std::map<Key, T*> visible;
+	auto row = fRows.at_index(first);
+	for (int32 index = first; index <= last; index++, ++row) {
+		auto it = fViews.find(row->first);
+		if (it != fViews.end()) {
+			visible.insert(*it);
+			fViews.erase(it);
+		}
+	}
+	for (auto& [key, view] : fViews)
+		_RecycleView(view);
+	fViews.swap(visible);
+
+	row = fRows.at_index(first);
+	for (int32 index = first; index <= last; index++, ++row) {
+		const Key& key = row->first;
+		T* view;
+		auto it = fViews.find(key);
+		if (it != fViews.end()) {
+			view = it->second;
+		} else {
+			// the erase notice may still be on its way
+			auto entry = fDataSource->Find(key);
+			if (entry == fDataSource->end())
+				continue;
+			view = _AcquireView(entry->second);
+			fViews[key] = view;
+		}
+
+		// only the rows behind an insertion or removal actually move
+		BPoint where = _ItemFrame(index).LeftTop();
+		if (view->Frame().LeftTop() != where)
+			view->MoveTo(where);
+	}
+}
+
+
+template<typename T, typename Key, typename Value, typename Source>
+T*
+DockListView<T, Key, Value, Source>::_AcquireView(const Value& value)
+{
+	if (fSpareViews.empty()) {
+		T* view = new T(value);
+		AddChild(view);
+		view->ResizeTo(view->PreferredSize());
+		return view;
+	}
+
+	T* view = fSpareViews.back();
+	fSpareViews.pop_back();
+	view->SetItem(value);
+	view->Show();
+	return view;
+}
+
+
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::_RecycleView(T* view)
+{
+	view->Hide();
+	fSpareViews.push_back(view);
+}
+
+
+// The first item decides the size of all of them
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::_MeasureItems()
+{
+	if (fItemSize.IsWidthSet() || fRows.empty())
+		return;
+
+	if (fMode == DOCK_LIST_FLYWEIGHT) {
+		font_height height;
+		GetFontHeight(&height);
+		fLabelHeight = ceilf(height.ascent) + ceilf(height.descent)
+			+ ceilf(height.leading) + 4;
+		const BBitmap* icon = fRows.item_at(0).second.icon;
+		BSize iconSize = icon != nullptr ? icon->Bounds().Size() : BSize(0, 0);
+		fItemSize = BSize(iconSize.Width(), iconSize.Height() + fLabelHeight
+			+ ceilf(height.descent));
+		return;
+	}
+
+	auto entry = fDataSource->Find(fRows.item_at(0).first);
+	if (entry != fDataSource->end()) {
+		T* view = _AcquireView(entry->second);
+		fItemSize = view->PreferredSize();
+		_RecycleView(view);
+	}
+}
+
+
+template<typename T, typename Key, typename Value, typename Source>
+float
+DockListView<T, Key, Value, Source>::_Pitch() const
+{
+	return (fOrientation == B_VERTICAL ? fItemSize.Height() : fItemSize.Width())
+		+ 1 + fSpacing;
+}
+
+
+template<typename T, typename Key, typename Value, typename Source>
+BRect
+DockListView<T, Key, Value, Source>::_ItemFrame(int32 index) const
+{
+	BRect bounds = Bounds();
+	float offset = kInset + index * _Pitch();
+	BPoint where = fOrientation == B_VERTICAL
+		? BPoint(roundf((bounds.Width() - fItemSize.Width()) / 2), offset)
+		: BPoint(offset, roundf((bounds.Height() - fItemSize.Height()) / 2));
+	return BRect(where, where + BPoint(fItemSize.Width(), fItemSize.Height()));
+}
+
+
+// Indices of the items intersecting area, widened by overscan items on
+// either side; last < first if there are none
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::_ItemRange(BRect area, int32 overscan, int32* first,
+	int32* last) const
+{
+	bool vertical = fOrientation == B_VERTICAL;
+	float pitch = _Pitch();
+	float start = (vertical ? area.top : area.left) - kInset;
+	float end = (vertical ? area.bottom : area.right) - kInset;
+	*first = std::max((int32)floorf(start / pitch) - overscan, (int32)0);
+	*last = std::min((int32)ceilf(end / pitch) + overscan, fRows.size() - 1);
+}
+
+
+template<typename T, typename Key, typename Value, typename Source>
+int32
+DockListView<T, Key, Value, Source>::_ItemAt(BPoint where) const
+{
+	if (!fItemSize.IsWidthSet())
+		return -1;
+
+	float offset = (fOrientation == B_VERTICAL ? where.y : where.x) - kInset;
+	if (offset < 0)
+		return -1;
+	int32 index = (int32)(offset / _Pitch());
+	if (index >= fRows.size() || !_ItemFrame(index).Contains(where))
+		return -1;
+	return index;
+}
+
+
+// Length of all items along the orientation, computed from the item count
+// unless there is a group layout
+template<typename T, typename Key, typename Value, typename Source>
+float
+DockListView<T, Key, Value, Source>::_ContentExtent()
+{
+	if (fMode != DOCK_LIST_ALL_VIEWS) {
+		if (fRows.empty() || !fItemSize.IsWidthSet())
+			return 0;
+		float size = (fOrientation == B_VERTICAL ? fItemSize.Height() : fItemSize.Width()) + 1;
+		return 2 * kInset + fRows.size() * (size + fSpacing) - fSpacing;
+	}
+
+	int32 count = fLayout.View()->CountChildren();
+	if (count == 0)
+		return 0;
+	return fLayout.View()->ChildAt(count - 1)->Frame().bottom + 17;
+}
+
+
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::_FixupScrollBar()
 {
 	printf("_FixupScrollBar()\n");
 
@@ -211,25 +835,8 @@ DockListView<T, Key, Value>::_FixupScrollBar()
 	if (vertScroller != NULL) {
 
 		int32 size = fDataSource->Size();
-		int32 count = fLayout.View()->CountChildren();
-		printf("Size %d - count %d\n", size, count);
-		// printf("Bounds: ");
-		// bounds.PrintToStream();
-
-		float itemHeight = 0.0;
-
-		if (size > 0) {
-			// for (int i = 0; i < count; i++) {
-				auto itemFrame = fLayout.View()->ChildAt(count - 1)->Frame();
-				// printf("Item frame: ");
-				// itemFrame.PrintToStream();
-				auto currentHeight = itemFrame.bottom;
-				itemHeight = itemFrame.bottom;
-				// if (currentHeight > itemHeight)
-					// itemHeight = currentHeight;
-				itemHeight += 17;
-			// }
-		}
+		float itemHeight = _ContentExtent();
+
 		// printf("itemHeight %f\n", itemHeight);
 		if (bounds.Height() >= itemHeight) {
 			// no scrolling
@@ -249,6 +856,8 @@ DockListView<T, Key, Value>::_FixupScrollBar()
 		if (size != 0) {
 			// auto steps = ceilf((fLayout.View()->ChildAt(count - 1))->Frame().Height());
 			auto steps = ceilf(itemHeight);
+			if (fMode != DOCK_LIST_ALL_VIEWS && fItemSize.IsHeightSet())
+				steps = ceilf(fItemSize.Height() + 1 + fSpacing);
 			vertScroller->SetSteps(steps, bounds.Height());
 		}
 	}
@@ -270,11 +879,49 @@ DockListView<T, Key, Value>::_FixupScrollBar()
 	}
 }
 
-template<typename T, typename Key, typename Value>
+// All changes handled within one looper cycle share a single layout pass
+template<typename T, typename Key, typename Value, typename Source>
 void
-DockListView<T, Key, Value>::_RedoLayout()
+DockListView<T, Key, Value, Source>::_ScheduleLayout()
 {
-	Layout(true);
+	if (fLayoutScheduled || Looper() == nullptr)
+		return;
+	fLayoutScheduled = Looper()->PostMessage(kMsgRedoLayout, this) == B_OK;
+	if (!fLayoutScheduled)
+		_RedoLayout();
+}
+
+
+// The group layout invalidates itself when views come and go, so it is
+// only laid out if needed rather than forced through all children.
+template<typename T, typename Key, typename Value, typename Source>
+void
+DockListView<T, Key, Value, Source>::_RedoLayout()
+{
+	switch (fMode) {
+		case DOCK_LIST_ALL_VIEWS:
+			Layout(false);
+			break;
+		case DOCK_LIST_VIRTUAL:
+			_UpdateVisibleItems();
+			break;
+		case DOCK_LIST_FLYWEIGHT: {
+			_MeasureItems();
+			if (fDirtyFrom == INT32_MAX || !fItemSize.IsWidthSet())
+				break;
+			// everything from the first changed item on moved
+			BRect dirty = Bounds();
+			BRect frame = _ItemFrame(fDirtyFrom);
+			if (fOrientation == B_VERTICAL)
+				dirty.top = std::max(dirty.top, frame.top);
+			else
+				dirty.left = std::max(dirty.left, frame.left);
+			if (dirty.IsValid())
+				Invalidate(dirty);
+			fDirtyFrom = INT32_MAX;
+			break;
+		}
+	}
 	_FixupScrollBar();
 }
 
@@ -3,7 +3,7 @@
  * All rights reserved. Distributed under the terms of the MIT license.
  */
  // Version 2
- // Requires C++17
+ // Requires C++17, C++20 for std::span fields
  //
  // Example:
  //   GMessage msg;
@@ -13,6 +13,10 @@
  //
  //   printf("Points: %d\n", (int32)msg["points"]);
  //
+ // multi-item fields:
+ //   msg["scores"] = std::vector<int32>{ 3, 1, 4 };
+ //   std::vector<int32> scores = msg["scores"];
+ //
  // brace-enclosed list:
  //  GMessage msg2 = { {"name", "Andrea"}, {"points", 1412}, {"active", true} };
  //
@@ -39,28 +43,46 @@
 
 #include <cstring>
 #include <memory>
+#include <optional>
+#if __cplusplus >= 202002L
+#include <span>
+#endif
 #include <string>
+#include <type_traits>
 #include <variant>
+#include <vector>
 
-#define KV(T) kv_pair(const std::string &k, T v) : pair(k, std::make_shared<mapped_type>(v)) {}
+#define KV(T, STORED) kv_pair(const char* k, T v) : first(k), second(std::in_place_type<STORED>, v) {}
 
-#define SUPPORTED_1		int32, bool, const char*, BString, GMessage, rgb_color
+#define SUPPORTED_1		int32, bool, const char*, BString, const BMessage*, variant_list, rgb_color
 #if __HAIKU_BEOS_COMPATIBLE_TYPES
-#define SUPPORTED_2		KV(int); KV(int32); KV(bool); KV(const char*); KV(BString); KV(GMessage);
+#define SUPPORTED_2		KV(int, int32); KV(int32, int32); KV(bool, bool); KV(const char*, const char*); \
+						KV(const BString&, BString); KV(rgb_color, rgb_color);
 #else
-#define SUPPORTED_2		KV(int32); KV(bool); KV(const char*); KV(BString); KV(GMessage); KV(rgb_color);
+#define SUPPORTED_2		KV(int32, int32); KV(bool, bool); KV(const char*, const char*); \
+						KV(const BString&, BString); KV(rgb_color, rgb_color);
 #endif
 
 class GMessageReturn;
 class GMessage : public BMessage {
 public:
+	struct kv_pair;
+	using variant_list = std::initializer_list<kv_pair>;
 	using mapped_type = std::variant<SUPPORTED_1>;
-	struct kv_pair : public std::pair<std::string, std::shared_ptr<mapped_type>>
+
+	// Keeps the value inline and the key, a message or a nested list by
+	// reference, so building a message from a list doesn't allocate
+	// anything but the message itself. Like for the strings, whatever is
+	// referenced has to outlive the list.
+	struct kv_pair
 	{
 		SUPPORTED_2
-	};
+		kv_pair(const char* k, const BMessage& v) : first(k), second(&v) {}
+		kv_pair(const char* k, variant_list v) : first(k), second(v) {}
 
-	using variant_list = std::initializer_list<kv_pair>;
+		const char*	first;
+		mapped_type	second;
+	};
 
 	explicit GMessage()
 		:
@@ -90,11 +112,11 @@ public:
 	type_code Type(const char* key) const
 	{
 		type_code type;
-		return (GetInfo(key, &type) == B_OK ? type : B_ANY_TYPE);
+		return (GetInfo(key, &type) == B_OK ? type : (type_code)B_ANY_TYPE);
 	}
 
 private:
-	void _HandleVariantList(variant_list& list);
+	void _HandleVariantList(const variant_list& list);
 };
 
 
@@ -123,6 +145,8 @@ template<> \
 class MessageValue<TYPE> { \
 public: \
 	static TYPE	Get(GMessage* msg, const char* key) { return msg->Get ## NAME (key, DEFAULT); } \
+	static status_t	Find(const BMessage* msg, const char* key, TYPE* value) { \
+						return msg->Find ## NAME (key, value); } \
 	static void		Set(GMessage* msg, const char* key, TYPE value) { msg->Set ## NAME (key, value); } \
 	static constexpr type_code	Type()  { return typeCODE; } \
 };
@@ -136,6 +160,8 @@ public: \
 						TYPE value; \
 						msg->Find ## NAME (key, &value); \
 						return value; } \
+	static status_t	Find(const BMessage* msg, const char* key, TYPE* value) { \
+						return msg->Find ## NAME (key, value); } \
 	static void	Set(GMessage* msg, const char* key, TYPE value) { \
 						msg->RemoveName(key); \
 						msg->Add ## NAME (key, &value); } \
@@ -183,21 +209,146 @@ MESSAGE_VALUE(Color, rgb_color, B_RGB_COLOR_TYPE, rgb_color());
 MESSAGE_VALUE_REF(Ref, entry_ref, B_REF_TYPE);
 MESSAGE_VALUE_REF(NodeRef, node_ref, B_NODE_REF_TYPE);
 
+
+// Values the message stores as they are in memory
+template<typename T>
+inline constexpr bool is_fixed_size_message_value = std::is_trivially_copyable_v<T>
+	&& !std::is_pointer_v<T> && !std::is_same_v<T, bool>
+	&& MessageValue<T>::Type() != B_ANY_TYPE;
+
+
+// A vector of values is stored as one field with an item per value; fixed
+// size items reserve room for all of them with the first one. Strings and
+// refs are supported as well.
+template<typename T>
+class MessageValue<std::vector<T> > {
+public:
+	static_assert(is_fixed_size_message_value<T> || std::is_same_v<T, BString>
+		|| std::is_same_v<T, entry_ref>, "unsupported item type for a multi-item field");
+
+	static std::vector<T> Get(GMessage* msg, const char* key)
+	{
+		std::vector<T> values;
+		Find(msg, key, &values);
+		return values;
+	}
+	static status_t	Find(const BMessage* msg, const char* key, std::vector<T>* found)
+	{
+		type_code type;
+		int32 count;
+		status_t status = msg->GetInfo(key, &type, &count);
+		if (status != B_OK)
+			return status;
+		if (type != Type())
+			return B_BAD_TYPE;
+
+		std::vector<T> values(count);
+		for (int32 index = 0; index < count; index++) {
+			if constexpr (std::is_same_v<T, BString>)
+				msg->FindString(key, index, &values[index]);
+			else if constexpr (std::is_same_v<T, entry_ref>)
+				msg->FindRef(key, index, &values[index]);
+			else {
+				const void* data;
+				ssize_t size;
+				if (msg->FindData(key, type, index, &data, &size) == B_OK
+					&& size == sizeof(T))
+					::memcpy(&values[index], data, sizeof(T));
+			}
+		}
+		found->swap(values);
+		return B_OK;
+	}
+	static void	Set(GMessage* msg, const char* key, const std::vector<T>& values)
+	{
+		SetItems(msg, key, values.data(), values.size());
+	}
+	static void	SetItems(GMessage* msg, const char* key, const T* values, size_t count)
+	{
+		msg->RemoveName(key);
+		for (size_t index = 0; index < count; index++) {
+			if constexpr (std::is_same_v<T, BString>)
+				msg->AddString(key, values[index]);
+			else if constexpr (std::is_same_v<T, entry_ref>)
+				msg->AddRef(key, &values[index]);
+			else
+				msg->AddData(key, Type(), &values[index], sizeof(T), true, count);
+		}
+	}
+	static constexpr type_code Type() { return MessageValue<T>::Type(); }
+};
+
+
+#if __cplusplus >= 202002L
+// Stored like a vector, for setting a field from an array without copying.
+// Getting one returns the fixed size items where the message keeps them,
+// valid until the message changes. That needs them to be one after the
+// other and aligned for T, which is checked; if they aren't, or the field
+// is missing, the span is empty and Find() fails with B_BAD_DATA.
+template<typename T>
+class MessageValue<std::span<const T> > {
+public:
+	static std::span<const T> Get(GMessage* msg, const char* key)
+	{
+		std::span<const T> values;
+		Find(msg, key, &values);
+		return values;
+	}
+	static status_t	Find(const BMessage* msg, const char* key, std::span<const T>* found)
+	{
+		static_assert(is_fixed_size_message_value<T>,
+			"a span can only refer to fixed size items");
+
+		*found = std::span<const T>();
+		type_code type;
+		int32 count;
+		status_t status = msg->GetInfo(key, &type, &count);
+		if (status != B_OK)
+			return status;
+		if (type != Type())
+			return B_BAD_TYPE;
+
+		const void* first;
+		const void* last;
+		ssize_t size;
+		if (msg->FindData(key, type, 0, &first, &size) != B_OK || size != sizeof(T)
+			|| msg->FindData(key, type, count - 1, &last, &size) != B_OK
+			|| (const char*)last - (const char*)first != (count - 1) * (ssize_t)sizeof(T)
+			|| (addr_t)first % alignof(T) != 0)
+			return B_BAD_DATA;
+
+		*found = std::span<const T>((const T*)first, count);
+		return B_OK;
+	}
+	static void	Set(GMessage* msg, const char* key, std::span<const T> values)
+	{
+		MessageValue<std::vector<T> >::SetItems(msg, key, values.data(), values.size());
+	}
+	static constexpr type_code Type() { return MessageValue<T>::Type(); }
+};
+#endif
+
+// Accessors for nested messages, like msg["a"]["b"], load each level once
+// and only write it back into its parent if something below changed, once
+// per expression, when the accessor goes away.
 class GMessageReturn {
 public:
-	GMessageReturn(GMessage* msg, const char* key, GMessageReturn* parent = nullptr)
+	GMessageReturn(GMessage* msg, const char* key)
+		:
+		fMsg(msg),
+		fKey(key),
+		fParent(nullptr),
+		fNestedChanged(false)
 	{
-		fMsg = msg;
-		fKey = key;
-		fSyncParent = parent;
 	}
 
+	GMessageReturn(const GMessageReturn&) = delete;
+
+	// Writes the nested message back if an accessor below changed it
 	~GMessageReturn()
 	{
-		if (fSyncParent != nullptr) {
-			*fSyncParent = *fMsg;
-			delete fMsg;
-		}
+		if (fNested.has_value() && fNestedChanged)
+			_StoreMessage(*fNested);
 	}
 
 	template< typename Return >
@@ -211,10 +362,11 @@ public:
 	{
 		if (!is_what(n))
 			MessageValue<T>::Set(fMsg, fKey, n);
+		_Changed();
 	}
 
 	template<typename T>
-	bool is_what(T n)
+	bool is_what(T /*n*/)
 	{
 		return false;
 	}
@@ -223,14 +375,13 @@ public:
 	operator=(GMessage::variant_list n)
 	{
 		GMessage xmsg(n);
-		MessageValue<GMessage>::Set(fMsg, fKey, xmsg);
+		_StoreMessage(xmsg);
+		_Changed();
 	}
 
 	auto operator[](const char* key) -> GMessageReturn
 	{
-		GMessage* newMsg = new GMessage();
-		fMsg->FindMessage(fKey, newMsg);
-		return GMessageReturn(newMsg, key, this);
+		return GMessageReturn(this, key);
 	}
 
 	void
@@ -247,6 +398,7 @@ public:
 			if (n.fMsg->FindData(n.fKey, typeFound, &data, &numBytes) == B_OK) {
 				fMsg->RemoveData(fKey); //remove the key
 				fMsg->SetData(fKey, typeFound, data, numBytes, fixedSize);
+				_Changed();
 			}
 		}
 	}
@@ -287,9 +439,54 @@ public:
 		fMsg->PrintToStream();
 	}
 private:
+	// Accessor for the field key of the message in parent's field, which
+	// the parent loads for all of its nested accessors
+	GMessageReturn(GMessageReturn* parent, const char* key)
+		:
+		fMsg(parent->_Nested()),
+		fKey(key),
+		fParent(parent),
+		fNestedChanged(false)
+	{
+	}
+
+	// BMessage keeps nested messages flattened, so reading one always
+	// unflattens a copy of it; this is done once per accessor.
+	GMessage*
+	_Nested()
+	{
+		if (!fNested.has_value()) {
+			fNested.emplace();
+			fMsg->FindMessage(fKey, &*fNested);
+		}
+		return &*fNested;
+	}
+
+	// The field changed, a nested message loaded before is stale
+	void
+	_Changed()
+	{
+		fNested.reset();
+		fNestedChanged = false;
+		if (fParent != nullptr)
+			fParent->fNestedChanged = true;
+	}
+
+	void
+	_StoreMessage(const BMessage& message)
+	{
+		fMsg->RemoveName(fKey);
+		fMsg->AddMessage(fKey, &message);
+		if (fParent != nullptr)
+			fParent->fNestedChanged = true;
+	}
+
 	GMessage* fMsg;
 	const char* fKey;
-	GMessageReturn* fSyncParent;
+	GMessageReturn* fParent;
+	std::optional<GMessage> fNested;
+		// the message in the field, once a nested accessor needed it
+	bool fNestedChanged;
 };
 
 // Heap Message, deprecated!
@@ -300,12 +497,26 @@ private:
 
 
 inline void
-GMessage::_HandleVariantList(variant_list& list)
+GMessage::_HandleVariantList(const variant_list& list)
 {
 	MakeEmpty();
-    for (auto &[k, v]: list) {
-		std::visit([&] (const auto& z) { (*this)[k.c_str()] = z; }, *v);
-    }
+	for (const kv_pair& pair : list) {
+		std::visit([&] (const auto& value) {
+			typedef std::decay_t<decltype(value)> Type;
+			if constexpr (std::is_same_v<Type, variant_list>) {
+				GMessage nested(value);
+				AddMessage(pair.first, &nested);
+			} else if constexpr (std::is_same_v<Type, const BMessage*>) {
+				AddMessage(pair.first, value);
+			} else if constexpr (std::is_same_v<Type, int32>) {
+				if (::strcmp(pair.first, "what") == 0)
+					what = value;
+				else
+					AddInt32(pair.first, value);
+			} else
+				MessageValue<Type>::Set(this, pair.first, value);
+		}, pair.second);
+	}
 }
 
 
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2024, Nexus6 <nexus6@disroot.org>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+ // Requires C++20
+ //
+ // Declares once which message field a struct member goes to, with its
+ // name and type code fixed at compile time:
+ //
+ //   struct point_notice {
+ //       BString	label;
+ //       int32		x = 0;
+ //   };
+ //
+ //   typedef MessageSchema<point_notice,
+ //       message_field<"label", &point_notice::label>,
+ //       message_field<"x", &point_notice::x> > PointNotice;
+ //
+ //   PointNotice::Archive({"origin", 0}, &message);
+ //   point_notice notice;
+ //   if (PointNotice::Unarchive(message, &notice) == B_OK)
+ //       ...
+ //   int32 x = PointNotice::Field<"x">::Get(message);
+ //
+ // Members of a type without a MessageValue, or a field name the schema
+ // doesn't have, don't compile.
+
+#pragma once
+
+#include "interface/GMessage.hpp"
+
+#include <Message.h>
+#include <SupportDefs.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+
+template<size_t N>
+struct field_name {
+	constexpr field_name(const char (&name)[N])
+	{
+		std::copy_n(name, N, value);
+	}
+
+	constexpr bool operator==(std::string_view other) const
+	{
+		return std::string_view(value) == other;
+	}
+
+	char value[N];
+};
+
+
+template<field_name Name, auto Member>
+struct message_field;
+
+
+template<field_name Name, typename Struct, typename Type, Type Struct::*Member>
+struct message_field<Name, Member> {
+	typedef Struct struct_type;
+	typedef Type value_type;
+
+	static constexpr const char* name = Name.value;
+	static constexpr type_code type = MessageValue<Type>::Type();
+	static_assert(type != B_ANY_TYPE, "no MessageValue for the type of this field");
+
+	static Type Get(const BMessage& message)
+	{
+		return MessageValue<Type>::Get((GMessage*)&message, name);
+	}
+
+	static void Set(BMessage* message, const Type& value)
+	{
+		MessageValue<Type>::Set((GMessage*)message, name, value);
+	}
+
+	static bool IsIn(const BMessage& message)
+	{
+		return message.HasData(name, type);
+	}
+
+	static void Archive(const Struct& data, BMessage* message)
+	{
+		Set(message, data.*Member);
+	}
+
+	// Looks the field up once, data keeps its value if it is missing
+	static bool Unarchive(const BMessage& message, Struct* data)
+	{
+		Type value;
+		if (MessageValue<Type>::Find(&message, name, &value) != B_OK)
+			return false;
+		data->*Member = std::move(value);
+		return true;
+	}
+};
+
+
+template<typename Struct, typename... Fields>
+class MessageSchema {
+	template<field_name Name>
+	static constexpr size_t _IndexOf()
+	{
+		constexpr const char* names[] = { Fields::name... };
+		size_t index = 0;
+		while (index < sizeof...(Fields) && !(Name == names[index]))
+			index++;
+		return index;
+	}
+
+	template<field_name Name>
+	struct _FieldNamed {
+		static constexpr size_t index = _IndexOf<Name>();
+		static_assert(index < sizeof...(Fields), "no field of that name in the schema");
+		typedef std::tuple_element_t<index, std::tuple<Fields...> > type;
+	};
+
+public:
+	static_assert((std::is_same_v<typename Fields::struct_type, Struct> && ...),
+		"all fields have to be members of the schema's struct");
+
+	template<field_name Name>
+	using Field = typename _FieldNamed<Name>::type;
+
+	static status_t Archive(const Struct& data, BMessage* message)
+	{
+		(Fields::Archive(data, message), ...);
+		return B_OK;
+	}
+
+	// Fields missing from the message, or of another type, keep their
+	// value in data and make it return B_BAD_VALUE.
+	static status_t Unarchive(const BMessage& message, Struct* data)
+	{
+		bool complete = (Fields::Unarchive(message, data) & ...);
+		return complete ? B_OK : B_BAD_VALUE;
+	}
+
+	static bool Matches(const BMessage& message)
+	{
+		return (Fields::IsIn(message) && ...);
+	}
+};
@@ -7,13 +7,19 @@
 
 #include <Handler.h>
 #include <Messenger.h>
+#include <String.h>
 #include <SupportDefs.h>
 
 #include "interface/GMessage.hpp"
 
+#include <algorithm>
 #include <functional>
 #include <iostream>
+#include <list>
 #include <map>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 using std::map;
@@ -28,6 +34,7 @@ namespace Observable {
 				~ObserverList();
 
 				status_t SendNotices(uint32 what, const BMessage* notice);
+				status_t SendNotice(uint32 what, BMessage* notice);
 				status_t Add(const BHandler* handler, uint32 what);
 				status_t Add(const BMessenger& messenger, uint32 what);
 				status_t Remove(const BHandler* handler, uint32 what);
@@ -59,7 +66,11 @@ namespace Observable {
 		inline void
 		ObserverList::_ValidateHandlers(uint32 what)
 		{
-			vector<const BHandler*>& handlers = fHandlerMap[what];
+			HandlerObserverMap::iterator found = fHandlerMap.find(what);
+			if (found == fHandlerMap.end())
+				return;
+
+			vector<const BHandler*>& handlers = found->second;
 			vector<const BHandler*>::iterator iterator = handlers.begin();
 
 			while (iterator != handlers.end()) {
@@ -73,7 +84,7 @@ namespace Observable {
 				iterator = handlers.erase(iterator);
 			}
 			if (handlers.empty())
-				fHandlerMap.erase(what);
+				fHandlerMap.erase(found);
 		}
 
 
@@ -85,7 +96,11 @@ namespace Observable {
 			_ValidateHandlers(what);
 
 			// now send it to all messengers we know
-			vector<BMessenger>& messengers = fMessengerMap[what];
+			MessengerObserverMap::iterator found = fMessengerMap.find(what);
+			if (found == fMessengerMap.end())
+				return;
+
+			vector<BMessenger>& messengers = found->second;
 			vector<BMessenger>::iterator iterator = messengers.begin();
 
 			while (iterator != messengers.end()) {
@@ -98,7 +113,7 @@ namespace Observable {
 				iterator++;
 			}
 			if (messengers.empty())
-				fMessengerMap.erase(what);
+				fMessengerMap.erase(found);
 		}
 
 
@@ -106,20 +121,26 @@ namespace Observable {
 		ObserverList::SendNotices(uint32 what, const BMessage* notice)
 		{
 			// printf("ObserverList::SendNotices(uint32 what, const BMessage* notice)\n");
-			BMessage* copy = NULL;
+			BMessage copy(B_OBSERVER_NOTICE_CHANGE);
 			if (notice != NULL) {
-				copy = new BMessage(*notice);
-				copy->what = B_OBSERVER_NOTICE_CHANGE;
-				copy->AddInt32(B_OBSERVE_ORIGINAL_WHAT, notice->what);
-			} else
-				copy = new BMessage(B_OBSERVER_NOTICE_CHANGE);
+				copy = *notice;
+				copy.what = B_OBSERVER_NOTICE_CHANGE;
+				copy.AddInt32(B_OBSERVE_ORIGINAL_WHAT, notice->what);
+			}
+			return SendNotice(what, &copy);
+		}
 
-			copy->AddInt32(B_OBSERVE_WHAT_CHANGE, what);
 
-			_SendNotices(what, copy);
-			_SendNotices(B_OBSERVER_OBSERVE_ALL, copy);
+		// Sends the notice as is, without copying it: the caller already
+		// set what to B_OBSERVER_NOTICE_CHANGE. Only the B_OBSERVE_WHAT_CHANGE
+		// field is updated, in place if it's there already.
+		inline status_t
+		ObserverList::SendNotice(uint32 what, BMessage* notice)
+		{
+			notice->SetInt32(B_OBSERVE_WHAT_CHANGE, what);
 
-			delete copy;
+			_SendNotices(what, notice);
+			_SendNotices(B_OBSERVER_OBSERVE_ALL, notice);
 
 			return B_OK;
 		}
@@ -226,9 +247,180 @@ namespace Observable {
 	enum {
 		ItemErased,
 		ItemInserted,
-		ItemsCleared
+		ItemsCleared,
+		ItemsChanged,
+			// a committed batch, "erased" and "inserted" hold the keys
+			// of the items, erased ones go first; "cleared" is set if
+			// the items before are gone as well
+		ItemMoved
+			// sent by ObservableSequence only
+	};
+
+	// Storage policies for ObservableMap, all with the std::map interface
+	// subset it needs.
+
+	// Ordered by key, the default.
+	template<typename Key, typename Value>
+	using OrderedStorage = std::map<Key, Value>;
+
+	template<typename Key>
+	struct Hash : std::hash<Key> {};
+
+	template<>
+	struct Hash<BString> {
+		size_t operator()(const BString& string) const { return string.HashValue(); }
+	};
+
+	// One hash and usually one key comparison per lookup, iterates in no
+	// particular order.
+	template<typename Key, typename Value>
+	using HashStorage = std::unordered_map<Key, Value, Hash<Key> >;
+
+	// A vector kept sorted by key: lookups are binary searches over
+	// contiguous memory, inserting and erasing moves the items behind.
+	template<typename Key, typename Value>
+	class FlatStorage {
+	public:
+		typedef std::pair<Key, Value> value_type;
+		typedef typename vector<value_type>::iterator iterator;
+		typedef typename vector<value_type>::const_iterator const_iterator;
+
+		Value& at(const Key& key)
+		{
+			iterator it = find(key);
+			if (it == end())
+				throw std::out_of_range("FlatStorage::at");
+			return it->second;
+		}
+
+		iterator find(const Key& key)
+		{
+			iterator it = _LowerBound(key);
+			if (it == end() || key < it->first)
+				return end();
+			return it;
+		}
+
+		std::pair<iterator, bool> insert_or_assign(const Key& key, const Value& value)
+		{
+			iterator it = _LowerBound(key);
+			if (it != end() && !(key < it->first)) {
+				it->second = value;
+				return std::make_pair(it, false);
+			}
+			return std::make_pair(fItems.insert(it, value_type(key, value)), true);
+		}
+
+		size_t erase(const Key& key)
+		{
+			iterator it = find(key);
+			if (it == end())
+				return 0;
+			fItems.erase(it);
+			return 1;
+		}
+
+		void clear() { fItems.clear(); }
+		size_t size() const { return fItems.size(); }
+
+		iterator begin() { return fItems.begin(); }
+		iterator end() { return fItems.end(); }
+		const_iterator begin() const { return fItems.begin(); }
+		const_iterator end() const { return fItems.end(); }
+
+	private:
+		iterator _LowerBound(const Key& key)
+		{
+			return std::lower_bound(fItems.begin(), fItems.end(), key,
+				[](const value_type& item, const Key& key) { return item.first < key; });
+		}
+
+		vector<value_type> fItems;
+	};
+
+
+	// Iterates in insertion order, a value assigned to a key already there
+	// keeps its place. A hash index points into a list of the items, so
+	// inserting, erasing and lookups don't depend on the number of items.
+	template<typename Key, typename Value>
+	class LinkedStorage {
+	public:
+		typedef std::pair<const Key, Value> value_type;
+		typedef typename std::list<value_type>::iterator iterator;
+		typedef typename std::list<value_type>::const_iterator const_iterator;
+
+		LinkedStorage() {}
+
+		LinkedStorage(const LinkedStorage& other)
+		{
+			*this = other;
+		}
+
+		LinkedStorage& operator=(const LinkedStorage& other)
+		{
+			if (this == &other)
+				return *this;
+			clear();
+			for (const value_type& item : other.fItems)
+				insert_or_assign(item.first, item.second);
+			return *this;
+		}
+
+		Value& at(const Key& key)
+		{
+			auto it = fIndex.find(key);
+			if (it == fIndex.end())
+				throw std::out_of_range("LinkedStorage::at");
+			return it->second->second;
+		}
+
+		iterator find(const Key& key)
+		{
+			auto it = fIndex.find(key);
+			return it == fIndex.end() ? end() : it->second;
+		}
+
+		std::pair<iterator, bool> insert_or_assign(const Key& key, const Value& value)
+		{
+			auto it = fIndex.find(key);
+			if (it != fIndex.end()) {
+				it->second->second = value;
+				return std::make_pair(it->second, false);
+			}
+			iterator item = fItems.insert(fItems.end(), value_type(key, value));
+			fIndex.emplace(key, item);
+			return std::make_pair(item, true);
+		}
+
+		size_t erase(const Key& key)
+		{
+			auto it = fIndex.find(key);
+			if (it == fIndex.end())
+				return 0;
+			fItems.erase(it->second);
+			fIndex.erase(it);
+			return 1;
+		}
+
+		void clear()
+		{
+			fIndex.clear();
+			fItems.clear();
+		}
+
+		size_t size() const { return fItems.size(); }
+
+		iterator begin() { return fItems.begin(); }
+		iterator end() { return fItems.end(); }
+		const_iterator begin() const { return fItems.begin(); }
+		const_iterator end() const { return fItems.end(); }
+
+	private:
+		std::list<value_type>			fItems;
+		std::unordered_map<Key, iterator, Hash<Key> > fIndex;
 	};
 
+
 	class IObservableContainer {
 	public:
 		// Observer calls for observing targets in the local team
@@ -241,10 +433,11 @@ namespace Observable {
 	};
 
 
-	template<typename Key, typename Value>
+	template<typename Key, typename Value,
+		template<typename, typename> class Storage = OrderedStorage>
 	class ObservableMap: public IObservableContainer {
 	public:
-										ObservableMap();
+										ObservableMap(int32 changeLogSize = 64);
 		virtual							~ObservableMap();
 
 		Value&							Get(const Key& key) { return fMap.at(key); }
@@ -254,6 +447,22 @@ namespace Observable {
 		auto							Size() const { return fMap.size(); };
 		auto							Find(Key key) { return fMap.find(key); }
 
+		// Changes between BeginBatch() and the matching Commit() are
+		// announced by a single ItemsChanged notice instead of one notice
+		// per change. Batches nest, only the outermost Commit() notifies.
+		void							BeginBatch();
+		void							Commit();
+		bool							IsBatching() const { return fBatchDepth > 0; }
+
+		// Every change counts up the version, which every notice carries as
+		// "version". ChangesSince() fills in an ItemsChanged message with
+		// what changed after the given version, as long as the change log
+		// reaches back that far, otherwise with all items and "cleared" set;
+		// it returns false in the latter case.
+		int64							Version() const { return fVersion; }
+		bool							ChangesSince(int64 version, BMessage* changes) const;
+		void							Snapshot(BMessage* changes) const;
+
 		auto	 						begin() { return fMap.begin(); };
 		auto		 					end() { return fMap.end(); };
 
@@ -266,58 +475,256 @@ namespace Observable {
 
 		// Value& operator[](const Key& key) { return fMap[key]; }
 	private:
-		std::map<Key, Value>			fMap;
+		Storage<Key, Value>				fMap;
 		Private::ObserverList*			fObserverList;
+		GMessage						fNotice;
+			// reused for every single item notice, see _Notify()
+
+		int32							fBatchDepth;
+		std::map<Key, bool>				fBatchInserted;
+			// true if the key was not in the map before the batch
+		vector<Key>						fBatchInsertOrder;
+		vector<Key>						fBatchErased;
+
+		struct change_record {
+			int64						version;
+			uint32						what;
+			Key							key;
+		};
+
+		int64							fVersion;
+		vector<change_record>			fChangeLog;
+			// a ring of the last fChangeLogSize changes
+		int32							fChangeLogSize;
+		int32							fChangeLogNext;
+
+		void							_BatchInsert(const Key& key, bool existed);
+		void							_BatchErase(const Key& key);
+		void							_Record(uint32 what, const Key& key);
 
 		Private::ObserverList*			_ObserverList();
 		virtual void					_SendNotices(uint32 what, const BMessage* notice) override;
+		void							_Notify(uint32 what, const Key* key);
 	};
 
 
-	template<typename Key, typename Value>
-	ObservableMap<Key, Value>::ObservableMap()
+	template<typename Key, typename Value, template<typename, typename> class Storage>
+	ObservableMap<Key, Value, Storage>::ObservableMap(int32 changeLogSize)
+		:
+		fObserverList(NULL),
+		fBatchDepth(0),
+		fVersion(0),
+		fChangeLogSize(std::max(changeLogSize, (int32)1)),
+		fChangeLogNext(0)
 	{
 	}
 
 
-	template<typename Key, typename Value>
-	ObservableMap<Key, Value>::~ObservableMap()
+	template<typename Key, typename Value, template<typename, typename> class Storage>
+	ObservableMap<Key, Value, Storage>::~ObservableMap()
 	{
+		delete fObserverList;
 	}
 
 
-	template<typename Key, typename Value>
+	template<typename Key, typename Value, template<typename, typename> class Storage>
 	void
-	ObservableMap<Key, Value>::Insert(const Key& key, const Value& value)
+	ObservableMap<Key, Value, Storage>::Insert(const Key& key, const Value& value)
 	{
+		if (IsBatching()) {
+			_BatchInsert(key, !fMap.insert_or_assign(key, value).second);
+			_Record(ItemInserted, key);
+			return;
+		}
 		fMap.insert_or_assign(key, value);
-		_SendNotices(ItemInserted, new GMessage({{"what", ItemInserted}, {"key", key}}));
+		_Record(ItemInserted, key);
+		_Notify(ItemInserted, &key);
 	}
 
 
 	// Remove
-	template<typename Key, typename Value>
+	template<typename Key, typename Value, template<typename, typename> class Storage>
 	bool
-	ObservableMap<Key, Value>::Erase(const Key& key)
+	ObservableMap<Key, Value, Storage>::Erase(const Key& key)
 	{
-		auto value = fMap.at(key);
-		_SendNotices(ItemErased, new GMessage({{"what", ItemErased}, {"key", key}}));
+		if (fMap.find(key) == fMap.end())
+			return false;
+
+		_Record(ItemErased, key);
+		if (IsBatching()) {
+			_BatchErase(key);
+			return fMap.erase(key);
+		}
+		_Notify(ItemErased, &key);
 		return fMap.erase(key);
 	}
 
 
-	template<typename Key, typename Value>
+	template<typename Key, typename Value, template<typename, typename> class Storage>
 	void
-	ObservableMap<Key, Value>::Clear()
+	ObservableMap<Key, Value, Storage>::Clear()
 	{
-		_SendNotices(ItemsCleared, new GMessage({{"what", ItemsCleared}}));
+		_Record(ItemsCleared, Key());
+		if (IsBatching()) {
+			for (auto& [key, value] : fMap)
+				_BatchErase(key);
+			fMap.clear();
+			return;
+		}
+		_Notify(ItemsCleared, NULL);
 		fMap.clear();
 	}
 
 
-	template<typename Key, typename Value>
+	template<typename Key, typename Value, template<typename, typename> class Storage>
+	void
+	ObservableMap<Key, Value, Storage>::BeginBatch()
+	{
+		fBatchDepth++;
+	}
+
+
+	template<typename Key, typename Value, template<typename, typename> class Storage>
+	void
+	ObservableMap<Key, Value, Storage>::Commit()
+	{
+		if (fBatchDepth == 0 || --fBatchDepth > 0)
+			return;
+
+		vector<Key> inserted;
+		for (const Key& key : fBatchInsertOrder) {
+			// skip keys erased again or inserted twice
+			auto it = fBatchInserted.find(key);
+			if (it == fBatchInserted.end())
+				continue;
+			fBatchInserted.erase(it);
+			inserted.push_back(key);
+		}
+		vector<Key> erased;
+		erased.swap(fBatchErased);
+		// nothing of this batch may show up in the next one
+		fBatchInserted.clear();
+		fBatchInsertOrder.clear();
+		if (erased.empty() && inserted.empty())
+			return;
+
+		GMessage notice(ItemsChanged);
+		notice.SetInt64("version", fVersion);
+		notice["erased"] = erased;
+		notice["inserted"] = inserted;
+		_SendNotices(ItemsChanged, &notice);
+	}
+
+
+	// A key inserted and erased within the same batch cancels out, unless
+	// it was in the map before.
+	template<typename Key, typename Value, template<typename, typename> class Storage>
+	void
+	ObservableMap<Key, Value, Storage>::_BatchInsert(const Key& key, bool existed)
+	{
+		if (fBatchInserted.find(key) != fBatchInserted.end())
+			return;
+		fBatchInserted[key] = !existed;
+		fBatchInsertOrder.push_back(key);
+	}
+
+
+	template<typename Key, typename Value, template<typename, typename> class Storage>
+	void
+	ObservableMap<Key, Value, Storage>::_BatchErase(const Key& key)
+	{
+		auto it = fBatchInserted.find(key);
+		if (it != fBatchInserted.end()) {
+			bool added = it->second;
+			fBatchInserted.erase(it);
+			if (added)
+				return;
+		}
+		fBatchErased.push_back(key);
+	}
+
+
+	template<typename Key, typename Value, template<typename, typename> class Storage>
+	void
+	ObservableMap<Key, Value, Storage>::_Record(uint32 what, const Key& key)
+	{
+		change_record record = { ++fVersion, what, key };
+		if ((int32)fChangeLog.size() < fChangeLogSize)
+			fChangeLog.push_back(record);
+		else
+			fChangeLog[fChangeLogNext] = record;
+		fChangeLogNext = (fChangeLogNext + 1) % fChangeLogSize;
+	}
+
+
+	// Only the last change of every key counts: a key inserted and erased
+	// again is listed as erased, which observers that never saw it ignore.
+	template<typename Key, typename Value, template<typename, typename> class Storage>
+	bool
+	ObservableMap<Key, Value, Storage>::ChangesSince(int64 version, BMessage* changes) const
+	{
+		int64 oldest = fVersion - fChangeLog.size();
+		if (version < oldest || version > fVersion) {
+			Snapshot(changes);
+			return false;
+		}
+
+		bool cleared = false;
+		std::map<Key, bool> inserted;
+		vector<Key> order;
+		int32 first = (int32)fChangeLog.size() < fChangeLogSize ? 0 : fChangeLogNext;
+		for (int64 next = version + 1; next <= fVersion; next++) {
+			const change_record& record
+				= fChangeLog[(first + next - oldest - 1) % fChangeLogSize];
+			if (record.what == ItemsCleared) {
+				cleared = true;
+				inserted.clear();
+				order.clear();
+				continue;
+			}
+			if (inserted.find(record.key) == inserted.end())
+				order.push_back(record.key);
+			inserted[record.key] = record.what == ItemInserted;
+		}
+
+		vector<Key> erasedKeys;
+		vector<Key> insertedKeys;
+		for (const Key& key : order)
+			(inserted[key] ? insertedKeys : erasedKeys).push_back(key);
+
+		GMessage* message = (GMessage*)changes;
+		message->MakeEmpty();
+		message->what = ItemsChanged;
+		message->SetInt64("version", fVersion);
+		if (cleared)
+			message->SetBool("cleared", true);
+		(*message)["erased"] = erasedKeys;
+		(*message)["inserted"] = insertedKeys;
+		return true;
+	}
+
+
+	template<typename Key, typename Value, template<typename, typename> class Storage>
+	void
+	ObservableMap<Key, Value, Storage>::Snapshot(BMessage* changes) const
+	{
+		vector<Key> keys;
+		keys.reserve(fMap.size());
+		for (auto it = fMap.begin(); it != fMap.end(); ++it)
+			keys.push_back(it->first);
+
+		GMessage* message = (GMessage*)changes;
+		message->MakeEmpty();
+		message->what = ItemsChanged;
+		message->SetInt64("version", fVersion);
+		message->SetBool("cleared", true);
+		(*message)["inserted"] = keys;
+	}
+
+
+	template<typename Key, typename Value, template<typename, typename> class Storage>
 	status_t
-	ObservableMap<Key, Value>::StartWatching(BHandler* observer, uint32 what)
+	ObservableMap<Key, Value, Storage>::StartWatching(BHandler* observer, uint32 what)
 	{
 		Private::ObserverList* list = _ObserverList();
 		if (list == NULL)
@@ -327,17 +734,17 @@ namespace Observable {
 	}
 
 
-	template<typename Key, typename Value>
+	template<typename Key, typename Value, template<typename, typename> class Storage>
 	status_t
-	ObservableMap<Key, Value>::StartWatchingAll(BHandler* observer)
+	ObservableMap<Key, Value, Storage>::StartWatchingAll(BHandler* /*observer*/)
 	{
 		return B_OK;
 	}
 
 
-	template<typename Key, typename Value>
+	template<typename Key, typename Value, template<typename, typename> class Storage>
 	status_t
-	ObservableMap<Key, Value>::StopWatching(BHandler* observer, uint32 what)
+	ObservableMap<Key, Value, Storage>::StopWatching(BHandler* observer, uint32 what)
 	{
 		Private::ObserverList* list = _ObserverList();
 		if (list == NULL)
@@ -347,26 +754,47 @@ namespace Observable {
 	}
 
 
-	template<typename Key, typename Value>
+	template<typename Key, typename Value, template<typename, typename> class Storage>
 	status_t
-	ObservableMap<Key, Value>::StopWatchingAll(BHandler* observer)
+	ObservableMap<Key, Value, Storage>::StopWatchingAll(BHandler* /*observer*/)
 	{
 		return B_OK;
 	}
 
 
-	template<typename Key, typename Value>
+	template<typename Key, typename Value, template<typename, typename> class Storage>
 	void
-	ObservableMap<Key, Value>::_SendNotices(uint32 what, const BMessage* notice)
+	ObservableMap<Key, Value, Storage>::_SendNotices(uint32 what, const BMessage* notice)
 	{
 		if (fObserverList != NULL)
 			fObserverList->SendNotices(what, notice);
 	}
 
 
-	template<typename Key, typename Value>
+	// Builds the notice in the same message every time. Its fields stay in
+	// place and only get new values, so notices with keys of a fixed size
+	// (like the negotiation IDs) don't allocate.
+	template<typename Key, typename Value, template<typename, typename> class Storage>
+	void
+	ObservableMap<Key, Value, Storage>::_Notify(uint32 what, const Key* key)
+	{
+		if (fObserverList == NULL)
+			return;
+
+		fNotice.what = B_OBSERVER_NOTICE_CHANGE;
+		fNotice.SetInt32(B_OBSERVE_ORIGINAL_WHAT, what);
+		fNotice.SetInt64("version", fVersion);
+		if (key != NULL)
+			fNotice["key"] = *key;
+		else
+			fNotice.RemoveName("key");
+		fObserverList->SendNotice(what, &fNotice);
+	}
+
+
+	template<typename Key, typename Value, template<typename, typename> class Storage>
 	Private::ObserverList*
-	ObservableMap<Key, Value>::_ObserverList()
+	ObservableMap<Key, Value, Storage>::_ObserverList()
 	{
 		if (fObserverList == NULL)
 			fObserverList = new (std::nothrow) Private::ObserverList();
@@ -375,9 +803,9 @@ namespace Observable {
 	}
 
 
-	template<typename Key, typename Value>
+	template<typename Key, typename Value, template<typename, typename> class Storage>
 	void
-	ObservableMap<Key, Value>::PrintKeysToStream() const
+	ObservableMap<Key, Value, Storage>::PrintKeysToStream() const
 	{
 		for (auto it = fMap.begin(); it != fMap.end(); ++it) {
 			std::cout << "Key = " << it->first << std::endl;
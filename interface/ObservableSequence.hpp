@@ -0,0 +1,615 @@
+/*
+ * Copyright 2024, Nexus6 <nexus6@disroot.org>
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#pragma once
+
+#include "interface/ObservableMap.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+namespace Observable {
+
+	// Keyed items in an order of their own, in a tree balanced by random
+	// priorities (a treap) whose nodes know the size of their subtree; a
+	// hash index finds the node of a key. Inserting, erasing and moving at
+	// any position, and going from a key to its position and back, take
+	// logarithmic time. New keys are appended unless a position is given,
+	// a value assigned to a key already there keeps its place.
+	template<typename Key, typename Value>
+	class SequenceStorage {
+		struct node;
+
+	public:
+		typedef std::pair<const Key, Value> value_type;
+
+		template<typename Item>
+		class basic_iterator {
+		public:
+			typedef std::forward_iterator_tag	iterator_category;
+			typedef Item						value_type;
+			typedef std::ptrdiff_t				difference_type;
+			typedef Item*						pointer;
+			typedef Item&						reference;
+
+			basic_iterator(node* item = NULL) : fNode(item) {}
+
+			Item& operator*() const { return fNode->item; }
+			Item* operator->() const { return &fNode->item; }
+			basic_iterator& operator++() { fNode = _Next(fNode); return *this; }
+			bool operator==(const basic_iterator& other) const { return fNode == other.fNode; }
+			bool operator!=(const basic_iterator& other) const { return fNode != other.fNode; }
+
+		private:
+			node*			fNode;
+		};
+
+		typedef basic_iterator<value_type> iterator;
+		typedef basic_iterator<const value_type> const_iterator;
+
+		SequenceStorage() : fRoot(NULL), fSeed(2463534242u) {}
+		SequenceStorage(const SequenceStorage& other) = delete;
+		~SequenceStorage() { clear(); }
+
+		SequenceStorage& operator=(const SequenceStorage& other) = delete;
+
+		Value& at(const Key& key)
+		{
+			auto it = fIndex.find(key);
+			if (it == fIndex.end())
+				throw std::out_of_range("SequenceStorage::at");
+			return it->second->item.second;
+		}
+
+		iterator find(const Key& key)
+		{
+			auto it = fIndex.find(key);
+			return it == fIndex.end() ? end() : iterator(it->second);
+		}
+
+		std::pair<iterator, bool> insert_or_assign(const Key& key, const Value& value)
+		{
+			return insert_at(size(), key, value);
+		}
+
+		// index is clamped to the items there are
+		std::pair<iterator, bool> insert_at(int32 index, const Key& key, const Value& value)
+		{
+			auto it = fIndex.find(key);
+			if (it != fIndex.end()) {
+				it->second->item.second = value;
+				return std::make_pair(iterator(it->second), false);
+			}
+
+			node* item = new node(key, value, _NextPriority());
+			fIndex.emplace(key, item);
+			_Attach(item, std::clamp(index, (int32)0, size()));
+			return std::make_pair(iterator(item), true);
+		}
+
+		size_t erase(const Key& key)
+		{
+			auto it = fIndex.find(key);
+			if (it == fIndex.end())
+				return 0;
+			node* item = it->second;
+			fIndex.erase(it);
+			_Detach(item);
+			delete item;
+			return 1;
+		}
+
+		void move(int32 from, int32 to)
+		{
+			node* item = _NodeAt(from);
+			if (item == NULL || to < 0 || to >= size())
+				return;
+			_Detach(item);
+			_Attach(item, to);
+		}
+
+		// -1 if the key isn't there
+		int32 index_of(const Key& key) const
+		{
+			auto it = fIndex.find(key);
+			if (it == fIndex.end())
+				return -1;
+
+			node* item = it->second;
+			int32 index = _Size(item->left);
+			for (; item->parent != NULL; item = item->parent) {
+				if (item == item->parent->right)
+					index += _Size(item->parent->left) + 1;
+			}
+			return index;
+		}
+
+		// end() if there is no such item
+		iterator at_index(int32 index) { return iterator(_NodeAt(index)); }
+
+		value_type& item_at(int32 index)
+		{
+			node* item = _NodeAt(index);
+			if (item == NULL)
+				throw std::out_of_range("SequenceStorage::item_at");
+			return item->item;
+		}
+
+		const value_type& item_at(int32 index) const
+		{
+			return const_cast<SequenceStorage*>(this)->item_at(index);
+		}
+
+		void clear()
+		{
+			_Delete(fRoot);
+			fRoot = NULL;
+			fIndex.clear();
+		}
+
+		int32 size() const { return _Size(fRoot); }
+		bool empty() const { return fRoot == NULL; }
+
+		iterator begin() { return iterator(_First()); }
+		iterator end() { return iterator(); }
+		const_iterator begin() const { return const_iterator(_First()); }
+		const_iterator end() const { return const_iterator(); }
+
+	private:
+		struct node {
+			node(const Key& key, const Value& value, uint32 priority)
+				:
+				item(key, value),
+				parent(NULL),
+				left(NULL),
+				right(NULL),
+				size(1),
+				priority(priority)
+			{
+			}
+
+			value_type		item;
+			node*			parent;
+			node*			left;
+			node*			right;
+			int32			size;
+			uint32			priority;
+		};
+
+		static int32 _Size(const node* item) { return item != NULL ? item->size : 0; }
+
+		// Recounts the subtree and adopts the children
+		static void _Update(node* item)
+		{
+			item->size = 1 + _Size(item->left) + _Size(item->right);
+			if (item->left != NULL)
+				item->left->parent = item;
+			if (item->right != NULL)
+				item->right->parent = item;
+		}
+
+		static node* _Merge(node* first, node* second)
+		{
+			if (first == NULL)
+				return second;
+			if (second == NULL)
+				return first;
+
+			if (first->priority > second->priority) {
+				first->right = _Merge(first->right, second);
+				_Update(first);
+				return first;
+			}
+			second->left = _Merge(first, second->left);
+			_Update(second);
+			return second;
+		}
+
+		// The first count items go to first, the others to second
+		static void _Split(node* item, int32 count, node** first, node** second)
+		{
+			if (item == NULL) {
+				*first = *second = NULL;
+				return;
+			}
+
+			if (_Size(item->left) < count) {
+				_Split(item->right, count - _Size(item->left) - 1, &item->right, second);
+				*first = item;
+			} else {
+				_Split(item->left, count, first, &item->left);
+				*second = item;
+			}
+			_Update(item);
+		}
+
+		static node* _Next(node* item)
+		{
+			if (item->right != NULL) {
+				item = item->right;
+				while (item->left != NULL)
+					item = item->left;
+				return item;
+			}
+			while (item->parent != NULL && item == item->parent->right)
+				item = item->parent;
+			return item->parent;
+		}
+
+		static void _Delete(node* item)
+		{
+			if (item == NULL)
+				return;
+			_Delete(item->left);
+			_Delete(item->right);
+			delete item;
+		}
+
+		node* _First() const
+		{
+			node* item = fRoot;
+			while (item != NULL && item->left != NULL)
+				item = item->left;
+			return item;
+		}
+
+		node* _NodeAt(int32 index) const
+		{
+			node* item = fRoot;
+			while (item != NULL) {
+				int32 before = _Size(item->left);
+				if (index == before)
+					return item;
+				if (index < before)
+					item = item->left;
+				else {
+					index -= before + 1;
+					item = item->right;
+				}
+			}
+			return NULL;
+		}
+
+		void _Attach(node* item, int32 index)
+		{
+			node* first;
+			node* second;
+			_Split(fRoot, index, &first, &second);
+			fRoot = _Merge(_Merge(first, item), second);
+			fRoot->parent = NULL;
+		}
+
+		// Takes the node out of the tree, its children take its place
+		void _Detach(node* item)
+		{
+			node* parent = item->parent;
+			node* children = _Merge(item->left, item->right);
+			if (children != NULL)
+				children->parent = parent;
+			if (parent == NULL)
+				fRoot = children;
+			else if (parent->left == item)
+				parent->left = children;
+			else
+				parent->right = children;
+			for (; parent != NULL; parent = parent->parent)
+				parent->size--;
+
+			item->parent = item->left = item->right = NULL;
+			item->size = 1;
+		}
+
+		uint32 _NextPriority()
+		{
+			// xorshift, good enough to keep the tree balanced
+			fSeed ^= fSeed << 13;
+			fSeed ^= fSeed >> 17;
+			fSeed ^= fSeed << 5;
+			return fSeed;
+		}
+
+		node*							fRoot;
+		std::unordered_map<Key, node*, Hash<Key> > fIndex;
+		uint32							fSeed;
+	};
+
+
+	// Keyed items kept in the order they were inserted. The notices carry
+	// the position of the item as "index" next to its "key", ItemMoved also
+	// the old position as "from", so observers can apply them to their rows
+	// directly.
+	// There is no change log, ChangesSince() always answers with all items
+	// in their order, and no batching.
+	//
+	// The items are in a SequenceStorage: lookups by key are a hash lookup,
+	// the positions the notices carry and inserting, erasing or moving
+	// anywhere cost logarithmic time.
+	template<typename Key, typename Value>
+	class ObservableSequence: public IObservableContainer {
+	public:
+		typedef typename SequenceStorage<Key, Value>::value_type value_type;
+		typedef typename SequenceStorage<Key, Value>::iterator iterator;
+
+										ObservableSequence();
+		virtual							~ObservableSequence();
+
+		Value&							Get(const Key& key) { return fItems.at(key); }
+		const Key&						KeyAt(int32 index) const;
+		int32							IndexOf(const Key& key) const;
+
+		// Appends the item, or replaces the value in place if the key is
+		// already there.
+		void 							Insert(const Key& key, const Value& value);
+		void 							InsertAt(int32 index, const Key& key, const Value& value);
+		bool 							Erase(const Key& key);
+		void							EraseAt(int32 index);
+		void							Move(int32 from, int32 to);
+		void 							Clear();
+		auto							Size() const { return fItems.size(); };
+		iterator						Find(const Key& key) { return fItems.find(key); }
+
+		int64							Version() const { return fVersion; }
+		bool							ChangesSince(int64 version, BMessage* changes) const;
+		void							Snapshot(BMessage* changes) const;
+
+		iterator						begin() { return fItems.begin(); };
+		iterator						end() { return fItems.end(); };
+
+		void							PrintKeysToStream() const;
+
+		virtual status_t				StartWatching(BHandler* observer, uint32 what) override;
+		virtual status_t				StartWatchingAll(BHandler* observer) override;
+		virtual status_t				StopWatching(BHandler* observer, uint32 what) override;
+		virtual status_t				StopWatchingAll(BHandler* observer) override;
+
+	private:
+		SequenceStorage<Key, Value>		fItems;
+		int64							fVersion;
+		Private::ObserverList*			fObserverList;
+		GMessage						fNotice;
+
+		Private::ObserverList*			_ObserverList();
+		virtual void					_SendNotices(uint32 what, const BMessage* notice) override;
+		void							_Notify(uint32 what, const Key* key,
+											int32 index = -1, int32 from = -1);
+	};
+
+
+	template<typename Key, typename Value>
+	ObservableSequence<Key, Value>::ObservableSequence()
+		:
+		fVersion(0),
+		fObserverList(NULL)
+	{
+	}
+
+
+	template<typename Key, typename Value>
+	ObservableSequence<Key, Value>::~ObservableSequence()
+	{
+		delete fObserverList;
+	}
+
+
+	template<typename Key, typename Value>
+	const Key&
+	ObservableSequence<Key, Value>::KeyAt(int32 index) const
+	{
+		return fItems.item_at(index).first;
+	}
+
+
+	template<typename Key, typename Value>
+	int32
+	ObservableSequence<Key, Value>::IndexOf(const Key& key) const
+	{
+		return fItems.index_of(key);
+	}
+
+
+	template<typename Key, typename Value>
+	void
+	ObservableSequence<Key, Value>::Insert(const Key& key, const Value& value)
+	{
+		bool inserted = fItems.insert_or_assign(key, value).second;
+		_Notify(ItemInserted, &key, inserted ? fItems.size() - 1 : fItems.index_of(key));
+	}
+
+
+	template<typename Key, typename Value>
+	void
+	ObservableSequence<Key, Value>::InsertAt(int32 index, const Key& key, const Value& value)
+	{
+		index = std::clamp(index, (int32)0, fItems.size());
+		int32 existing = fItems.index_of(key);
+		if (existing >= 0) {
+			fItems.at(key) = value;
+			_Notify(ItemInserted, &key, existing);
+			Move(existing, std::min(index, fItems.size() - 1));
+			return;
+		}
+
+		fItems.insert_at(index, key, value);
+		_Notify(ItemInserted, &key, index);
+	}
+
+
+	template<typename Key, typename Value>
+	bool
+	ObservableSequence<Key, Value>::Erase(const Key& key)
+	{
+		int32 index = fItems.index_of(key);
+		if (index < 0)
+			return false;
+
+		EraseAt(index);
+		return true;
+	}
+
+
+	template<typename Key, typename Value>
+	void
+	ObservableSequence<Key, Value>::EraseAt(int32 index)
+	{
+		Key key = fItems.item_at(index).first;
+		fItems.erase(key);
+		_Notify(ItemErased, &key, index);
+	}
+
+
+	template<typename Key, typename Value>
+	void
+	ObservableSequence<Key, Value>::Move(int32 from, int32 to)
+	{
+		if (from < 0 || from >= fItems.size() || to < 0 || to >= fItems.size()
+			|| from == to)
+			return;
+
+		fItems.move(from, to);
+		_Notify(ItemMoved, &fItems.item_at(to).first, to, from);
+	}
+
+
+	template<typename Key, typename Value>
+	void
+	ObservableSequence<Key, Value>::Clear()
+	{
+		_Notify(ItemsCleared, NULL);
+		fItems.clear();
+	}
+
+
+	template<typename Key, typename Value>
+	status_t
+	ObservableSequence<Key, Value>::StartWatching(BHandler* observer, uint32 what)
+	{
+		Private::ObserverList* list = _ObserverList();
+		if (list == NULL)
+			return B_NO_MEMORY;
+
+		return list->Add(observer, what);
+	}
+
+
+	template<typename Key, typename Value>
+	status_t
+	ObservableSequence<Key, Value>::StartWatchingAll(BHandler* /*observer*/)
+	{
+		return B_OK;
+	}
+
+
+	template<typename Key, typename Value>
+	status_t
+	ObservableSequence<Key, Value>::StopWatching(BHandler* observer, uint32 what)
+	{
+		Private::ObserverList* list = _ObserverList();
+		if (list == NULL)
+			return B_NO_MEMORY;
+
+		return fObserverList->Remove(observer, what);
+	}
+
+
+	template<typename Key, typename Value>
+	status_t
+	ObservableSequence<Key, Value>::StopWatchingAll(BHandler* /*observer*/)
+	{
+		return B_OK;
+	}
+
+
+	template<typename Key, typename Value>
+	void
+	ObservableSequence<Key, Value>::_SendNotices(uint32 what, const BMessage* notice)
+	{
+		if (fObserverList != NULL)
+			fObserverList->SendNotices(what, notice);
+	}
+
+
+	template<typename Key, typename Value>
+	bool
+	ObservableSequence<Key, Value>::ChangesSince(int64 /*version*/, BMessage* changes) const
+	{
+		Snapshot(changes);
+		return false;
+	}
+
+
+	template<typename Key, typename Value>
+	void
+	ObservableSequence<Key, Value>::Snapshot(BMessage* changes) const
+	{
+		vector<Key> keys;
+		keys.reserve(fItems.size());
+		for (const value_type& item : fItems)
+			keys.push_back(item.first);
+
+		GMessage* message = (GMessage*)changes;
+		message->MakeEmpty();
+		message->what = ItemsChanged;
+		message->SetInt64("version", fVersion);
+		message->SetBool("cleared", true);
+		(*message)["inserted"] = keys;
+	}
+
+
+	// Reuses one message like ObservableMap::_Notify()
+	template<typename Key, typename Value>
+	void
+	ObservableSequence<Key, Value>::_Notify(uint32 what, const Key* key,
+		int32 index, int32 from)
+	{
+		fVersion++;
+		if (fObserverList == NULL)
+			return;
+
+		fNotice.what = B_OBSERVER_NOTICE_CHANGE;
+		fNotice.SetInt32(B_OBSERVE_ORIGINAL_WHAT, what);
+		fNotice.SetInt64("version", fVersion);
+		if (key != NULL)
+			fNotice["key"] = *key;
+		else
+			fNotice.RemoveName("key");
+		if (index >= 0)
+			fNotice.SetInt32("index", index);
+		else
+			fNotice.RemoveName("index");
+		if (from >= 0)
+			fNotice.SetInt32("from", from);
+		else
+			fNotice.RemoveName("from");
+		fObserverList->SendNotice(what, &fNotice);
+	}
+
+
+	template<typename Key, typename Value>
+	Private::ObserverList*
+	ObservableSequence<Key, Value>::_ObserverList()
+	{
+		if (fObserverList == NULL)
+			fObserverList = new (std::nothrow) Private::ObserverList();
+
+		return fObserverList;
+	}
+
+
+	template<typename Key, typename Value>
+	void
+	ObservableSequence<Key, Value>::PrintKeysToStream() const
+	{
+		int32 index = 0;
+		for (const value_type& item : fItems)
+			std::cout << index++ << ": Key = " << item.first << std::endl;
+	}
+
+}
@@ -5,14 +5,30 @@
 
 #pragma once
 
-#include <any>
-#include <map>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+#include <type_traits>
+#include <variant>
+#include <vector>
 
 #include <Alignment.h>
 #include <Archivable.h>
+#include <Locker.h>
 #include <Message.h>
 #include <Messenger.h>
+#include <OS.h>
+#include <Referenceable.h>
 #include <String.h>
 #include "GMessage.hpp"
 
@@ -21,142 +37,1381 @@ namespace Genio::Task {
 
 	using namespace std;
 
+	class CancellationToken;
+
+	// A manual reset event a task body can wait on together with its
+	// cancellation token, see CancellationToken::WaitFor().
+	class TaskEvent {
+	public:
+		TaskEvent()
+			:
+			fSignaled(false)
+		{
+		}
+
+		void Signal()
+		{
+			lock_guard<mutex> lock(fLock);
+			fSignaled = true;
+			fCondition.notify_all();
+		}
+
+		void Reset()
+		{
+			lock_guard<mutex> lock(fLock);
+			fSignaled = false;
+		}
+
+		bool IsSignaled()
+		{
+			lock_guard<mutex> lock(fLock);
+			return fSignaled;
+		}
+
+	private:
+		friend class CancellationToken;
+
+		mutex				fLock;
+		condition_variable	fCondition;
+		bool				fSignaled;
+	};
+
+	namespace Private {
+
+		struct CancellationState {
+			atomic<bool>		cancelled { false };
+			mutex				lock;
+			vector<TaskEvent*>	waiters;
+			vector<shared_ptr<CancellationState> > linked;
+		};
+	}
+
+	// Shared flag a task body polls or waits on to learn that it should
+	// finish early. Copies refer to the same state, so one token can be
+	// handed to many tasks and cancel all of them at once.
+	class CancellationToken {
+	public:
+		CancellationToken()
+			:
+			fState(make_shared<Private::CancellationState>())
+		{
+		}
+
+		bool IsCancelled() const
+		{
+			return fState->cancelled.load(memory_order_acquire);
+		}
+
+		void Cancel()
+		{
+			if (fState->cancelled.exchange(true, memory_order_acq_rel))
+				return;
+
+			vector<shared_ptr<Private::CancellationState> > linked;
+			{
+				lock_guard<mutex> lock(fState->lock);
+				for (TaskEvent* event : fState->waiters) {
+					lock_guard<mutex> eventLock(event->fLock);
+					event->fCondition.notify_all();
+				}
+				linked.swap(fState->linked);
+			}
+			for (auto& state : linked)
+				CancellationToken(state).Cancel();
+		}
+
+		// Returns a new token that gets cancelled along with this one, but
+		// can also be cancelled on its own without affecting this one.
+		CancellationToken CreateLinked() const
+		{
+			CancellationToken linked;
+			{
+				lock_guard<mutex> lock(fState->lock);
+				if (!IsCancelled()) {
+					fState->linked.push_back(linked.fState);
+					return linked;
+				}
+			}
+			linked.Cancel();
+			return linked;
+		}
+
+		// Sleeps until the timeout elapses, returns true if the token got
+		// cancelled in the meantime.
+		bool Wait(bigtime_t timeout) const
+		{
+			TaskEvent never;
+			return WaitFor(never, timeout) == B_CANCELED;
+		}
+
+		// Returns B_OK when the event got signaled, B_CANCELED when the
+		// token got cancelled first, B_TIMED_OUT otherwise.
+		status_t WaitFor(TaskEvent& event, bigtime_t timeout = B_INFINITE_TIMEOUT) const
+		{
+			{
+				lock_guard<mutex> lock(fState->lock);
+				if (IsCancelled())
+					return B_CANCELED;
+				fState->waiters.push_back(&event);
+			}
+
+			status_t status;
+			{
+				unique_lock<mutex> lock(event.fLock);
+				auto ready = [&]() { return event.fSignaled || IsCancelled(); };
+				if (timeout == B_INFINITE_TIMEOUT)
+					event.fCondition.wait(lock, ready);
+				else
+					event.fCondition.wait_for(lock, chrono::microseconds(timeout), ready);
+
+				if (event.fSignaled)
+					status = B_OK;
+				else if (IsCancelled())
+					status = B_CANCELED;
+				else
+					status = B_TIMED_OUT;
+			}
+
+			lock_guard<mutex> lock(fState->lock);
+			auto waiter = find(fState->waiters.begin(), fState->waiters.end(), &event);
+			if (waiter != fState->waiters.end())
+				fState->waiters.erase(waiter);
+			return status;
+		}
+
+	private:
+		CancellationToken(const shared_ptr<Private::CancellationState>& state)
+			:
+			fState(state)
+		{
+		}
+
+		shared_ptr<Private::CancellationState> fState;
+	};
+
+	enum task_priority {
+		TASK_PRIORITY_INTERACTIVE,	// the user is waiting for it
+		TASK_PRIORITY_NORMAL,
+		TASK_PRIORITY_BACKGROUND,	// bulk work, never starves the others
+		TASK_PRIORITY_COUNT
+	};
+
+	// Counters of one priority class, see Executor::GetStats()
+	struct task_queue_stats {
+		int32		queued;				// jobs waiting right now
+		int64		started;
+		bigtime_t	total_wait;			// from Run() until a worker took it
+		bigtime_t	max_wait;
+		int64		missed_deadlines;	// started after their deadline
+	};
+
+	namespace Private {
+
+		template <typename ResultType>
+		using result_value_t = conditional_t<is_void_v<ResultType>, monostate, ResultType>;
+
+		// Filled in by the worker before the result message is posted and
+		// only read by the receiver afterwards, so it needs no lock. Until
+		// the receiver takes it, the SlotRegistry holds it for the message.
+		template <typename ResultType>
+		class ResultSlot : public BReferenceable {
+		public:
+			using value_type = result_value_t<ResultType>;
+
+			void			SetException(exception_ptr exception) { fException = exception; }
+			exception_ptr	Exception() const { return fException; }
+
+			void			SetValue(value_type&& value) { fValue.emplace(std::move(value)); }
+			bool			HasValue() const { return fValue.has_value(); }
+			value_type&		Value() { return *fValue; }
+
+		private:
+			exception_ptr	fException;
+			optional<value_type> fValue;
+		};
+
+		// The slots of the results posted within the team by task id, until
+		// a TaskResult takes them out. A message nobody reads goes away with
+		// the looper it was sent to; once the registry grew to twice the
+		// slots it held after the last check, the slots of such messages are
+		// released.
+		class SlotRegistry {
+		public:
+			static SlotRegistry& Default()
+			{
+				static SlotRegistry sRegistry;
+				return sRegistry;
+			}
+
+			void Add(int32 id, BReferenceable* slot, const BMessenger& target)
+			{
+				lock_guard<mutex> lock(fLock);
+				if (fSlots.size() >= fCheckSize)
+					_ReleaseUnreachable();
+				fSlots[id] = entry { BReference<BReferenceable>(slot), target };
+			}
+
+			// An unset reference if there is no slot for the task (anymore)
+			BReference<BReferenceable> Take(int32 id)
+			{
+				lock_guard<mutex> lock(fLock);
+				auto it = fSlots.find(id);
+				if (it == fSlots.end())
+					return BReference<BReferenceable>();
+				BReference<BReferenceable> slot = it->second.slot;
+				fSlots.erase(it);
+				return slot;
+			}
+
+		private:
+			static constexpr size_t kMinCheckSize = 64;
+
+			struct entry {
+				BReference<BReferenceable>	slot;
+				BMessenger					target;
+			};
+
+			SlotRegistry() : fCheckSize(kMinCheckSize) {}
+
+			void _ReleaseUnreachable()
+			{
+				for (auto it = fSlots.begin(); it != fSlots.end();) {
+					if (it->second.target.IsValid())
+						++it;
+					else
+						it = fSlots.erase(it);
+				}
+				fCheckSize = std::max(kMinCheckSize, 2 * fSlots.size());
+			}
+
+			mutex							fLock;
+			unordered_map<int32, entry>		fSlots;
+			size_t							fCheckSize;
+		};
+
+		enum {
+			kTaskQueued,
+			kTaskRunning,
+			kTaskFinished,
+			kTaskCancelled
+		};
+
+		struct TaskState {
+			atomic<int32>		status { kTaskQueued };
+			CancellationToken	token;
+		};
+
+		inline int32
+		NextTaskId()
+		{
+			static atomic<int32> sNextTaskId { 1 };
+			return sNextTaskId++;
+		}
+
+		class Job {
+		public:
+							Job()
+								:
+								priority(TASK_PRIORITY_NORMAL),
+								deadline(B_INFINITE_TIMEOUT),
+								queued(0)
+							{
+							}
+			virtual			~Job() {}
+			virtual void	Run() = 0;
+
+			int32			priority;
+			bigtime_t		deadline;
+			bigtime_t		queued;
+		};
+
+		// A fixed set of worker threads, one per CPU, each with its own job
+		// deques, one per priority class. Jobs submitted from a worker go to
+		// that worker's deques, the others are spread round robin. An idle
+		// worker pops from the back of its own deques and steals from the
+		// front of the others, highest priority class first. Jobs with a
+		// deadline are kept apart per class and run earliest deadline first,
+		// ahead of the other jobs of their class but never of a higher one.
+		//
+		// Background jobs never occupy all workers, so there is always one
+		// left for latency sensitive work.
+		class Executor {
+		public:
+			static Executor&	Default();
+
+			void				Submit(Job* job);
+			int32				CountWorkers() const { return fWorkerCount; }
+
+			void				GetStats(task_priority priority, task_queue_stats* stats) const;
+
+		private:
+								Executor();
+
+			struct WorkQueue {
+				Executor*		owner;
+				int32			index;
+				BLocker			lock;
+				deque<Job*>		jobs[TASK_PRIORITY_COUNT];
+			};
+
+			struct Counters {
+				atomic<int32>	queued { 0 };
+				atomic<int64>	started { 0 };
+				atomic<int64>	totalWait { 0 };
+				atomic<int64>	maxWait { 0 };
+				atomic<int64>	missedDeadlines { 0 };
+			};
+
+			static int32		_WorkerEntry(void* data);
+			void				_WorkerLoop(int32 index);
+			bool				_HasWork() const;
+			Job*				_NextJob(int32 index);
+			Job*				_NextJob(int32 index, int32 priority);
+			Job*				_NextDeadlineJob(int32 priority);
+			void				_Run(Job* job);
+
+			static bool			_LaterDeadline(const Job* a, const Job* b)
+									{ return a->deadline > b->deadline; }
+
+			WorkQueue*			fQueues;
+			int32				fWorkerCount;
+			atomic<uint32>		fNextQueue;
+
+			BLocker				fDeadlineLock;
+			vector<Job*>		fDeadlineJobs[TASK_PRIORITY_COUNT];
+
+			mutex				fWaitLock;
+			condition_variable	fWorkAvailable;
+
+			int32				fBackgroundLimit;
+			atomic<int32>		fBackgroundRunning;
+			Counters			fCounters[TASK_PRIORITY_COUNT];
+
+			static inline thread_local int32 sWorkerIndex = -1;
+			static inline thread_local int32 sThreadPriority = B_NORMAL_PRIORITY;
+		};
+
+
+		inline Executor&
+		Executor::Default()
+		{
+			// never destroyed, workers may still be running at exit
+			static Executor* sExecutor = new Executor();
+			return *sExecutor;
+		}
+
+
+		inline
+		Executor::Executor()
+			:
+			fQueues(nullptr),
+			fWorkerCount(2),
+			fNextQueue(0),
+			fBackgroundRunning(0)
+		{
+			system_info info;
+			if (get_system_info(&info) == B_OK && (int32)info.cpu_count > fWorkerCount)
+				fWorkerCount = info.cpu_count;
+			fBackgroundLimit = fWorkerCount - 1;
+
+			fQueues = new WorkQueue[fWorkerCount];
+			for (int32 i = 0; i < fWorkerCount; i++) {
+				fQueues[i].owner = this;
+				fQueues[i].index = i;
+				thread_id worker = spawn_thread(&_WorkerEntry, "task worker",
+					B_NORMAL_PRIORITY, &fQueues[i]);
+				if (worker < 0)
+					throw runtime_error("Can't create task worker");
+				resume_thread(worker);
+			}
+		}
+
+
+		inline void
+		Executor::Submit(Job* job)
+		{
+			int32 priority = job->priority;
+			if (priority < 0 || priority >= TASK_PRIORITY_COUNT)
+				priority = job->priority = TASK_PRIORITY_NORMAL;
+			job->queued = system_time();
+
+			if (job->deadline != B_INFINITE_TIMEOUT) {
+				vector<Job*>& deadlineJobs = fDeadlineJobs[priority];
+				fDeadlineLock.Lock();
+				deadlineJobs.push_back(job);
+				push_heap(deadlineJobs.begin(), deadlineJobs.end(), &_LaterDeadline);
+				fDeadlineLock.Unlock();
+			} else {
+				int32 index = sWorkerIndex;
+				if (index < 0)
+					index = fNextQueue++ % fWorkerCount;
+
+				WorkQueue& queue = fQueues[index];
+				queue.lock.Lock();
+				queue.jobs[priority].push_back(job);
+				queue.lock.Unlock();
+			}
+			fCounters[priority].queued++;
+
+			lock_guard<mutex> lock(fWaitLock);
+			fWorkAvailable.notify_one();
+		}
+
+
+		inline void
+		Executor::GetStats(task_priority priority, task_queue_stats* stats) const
+		{
+			const Counters& counters = fCounters[priority];
+			stats->queued = counters.queued;
+			stats->started = counters.started;
+			stats->total_wait = counters.totalWait;
+			stats->max_wait = counters.maxWait;
+			stats->missed_deadlines = counters.missedDeadlines;
+		}
+
+
+		inline int32
+		Executor::_WorkerEntry(void* data)
+		{
+			WorkQueue* queue = reinterpret_cast<WorkQueue*>(data);
+			queue->owner->_WorkerLoop(queue->index);
+			return B_OK;
+		}
+
+
+		inline void
+		Executor::_WorkerLoop(int32 index)
+		{
+			sWorkerIndex = index;
+			while (true) {
+				{
+					unique_lock<mutex> lock(fWaitLock);
+					fWorkAvailable.wait(lock, [this]() { return _HasWork(); });
+				}
+
+				// another worker may have been faster
+				Job* job = _NextJob(index);
+				if (job != nullptr)
+					_Run(job);
+			}
+		}
+
+
+		inline bool
+		Executor::_HasWork() const
+		{
+			return fCounters[TASK_PRIORITY_INTERACTIVE].queued > 0
+				|| fCounters[TASK_PRIORITY_NORMAL].queued > 0
+				|| (fCounters[TASK_PRIORITY_BACKGROUND].queued > 0
+					&& fBackgroundRunning < fBackgroundLimit);
+		}
+
+
+		inline Job*
+		Executor::_NextJob(int32 index)
+		{
+			Job* job = _NextDeadlineJob(TASK_PRIORITY_INTERACTIVE);
+			if (job == nullptr)
+				job = _NextJob(index, TASK_PRIORITY_INTERACTIVE);
+			if (job == nullptr)
+				job = _NextDeadlineJob(TASK_PRIORITY_NORMAL);
+			if (job == nullptr)
+				job = _NextJob(index, TASK_PRIORITY_NORMAL);
+			if (job == nullptr) {
+				// claim a background slot first, give it back if there is
+				// nothing to run
+				if (++fBackgroundRunning <= fBackgroundLimit) {
+					job = _NextDeadlineJob(TASK_PRIORITY_BACKGROUND);
+					if (job == nullptr)
+						job = _NextJob(index, TASK_PRIORITY_BACKGROUND);
+				}
+				if (job == nullptr)
+					fBackgroundRunning--;
+			}
+
+			if (job != nullptr)
+				fCounters[job->priority].queued--;
+			return job;
+		}
+
+
+		inline Job*
+		Executor::_NextJob(int32 index, int32 priority)
+		{
+			Job* job = nullptr;
+
+			WorkQueue& own = fQueues[index];
+			own.lock.Lock();
+			if (!own.jobs[priority].empty()) {
+				job = own.jobs[priority].back();
+				own.jobs[priority].pop_back();
+			}
+			own.lock.Unlock();
+
+			for (int32 i = 1; job == nullptr && i < fWorkerCount; i++) {
+				WorkQueue& victim = fQueues[(index + i) % fWorkerCount];
+				victim.lock.Lock();
+				if (!victim.jobs[priority].empty()) {
+					job = victim.jobs[priority].front();
+					victim.jobs[priority].pop_front();
+				}
+				victim.lock.Unlock();
+			}
+
+			return job;
+		}
+
+
+		inline Job*
+		Executor::_NextDeadlineJob(int32 priority)
+		{
+			Job* job = nullptr;
+			vector<Job*>& deadlineJobs = fDeadlineJobs[priority];
+
+			fDeadlineLock.Lock();
+			if (!deadlineJobs.empty()) {
+				pop_heap(deadlineJobs.begin(), deadlineJobs.end(), &_LaterDeadline);
+				job = deadlineJobs.back();
+				deadlineJobs.pop_back();
+			}
+			fDeadlineLock.Unlock();
+
+			return job;
+		}
+
+
+		inline void
+		Executor::_Run(Job* job)
+		{
+			static const int32 kThreadPriority[TASK_PRIORITY_COUNT] = {
+				B_DISPLAY_PRIORITY, B_NORMAL_PRIORITY, B_LOW_PRIORITY
+			};
+
+			int32 priority = job->priority;
+			bool holdsSlot = priority == TASK_PRIORITY_BACKGROUND;
+			Counters& counters = fCounters[priority];
+			bigtime_t now = system_time();
+			bigtime_t wait = now - job->queued;
+			counters.started++;
+			counters.totalWait += wait;
+			int64 maxWait = counters.maxWait;
+			while (wait > maxWait && !counters.maxWait.compare_exchange_weak(maxWait, wait))
+				;
+			if (now > job->deadline)
+				counters.missedDeadlines++;
+
+			if (sThreadPriority != kThreadPriority[priority]) {
+				sThreadPriority = kThreadPriority[priority];
+				set_thread_priority(find_thread(NULL), sThreadPriority);
+			}
+
+			job->Run();
+			delete job;
+
+			if (holdsSlot) {
+				fBackgroundRunning--;
+				lock_guard<mutex> lock(fWaitLock);
+				fWorkAvailable.notify_all();
+			}
+		}
+	}
+
+	using namespace Private;
+
+	const int TASK_RESULT_MESSAGE = 'tfwr';
+
+	// Tag to run a task on its own thread instead of the shared executor
+	struct dedicated_thread_t {};
+	inline constexpr dedicated_thread_t dedicated_thread {};
+
+	// Result of a task that got stopped before it could run, as seen by
+	// combinators and continuations
+	class TaskCancelled : public runtime_error {
+	public:
+		TaskCancelled()
+			:
+			runtime_error("Task cancelled")
+		{
+		}
+	};
+
+	namespace Private {
+
+		// Stores a value in a message leaving the team. Types GMessage knows
+		// are added as such, other plain data byte by byte.
+		template <typename Type>
+		status_t
+		ArchiveValue(BMessage* archive, const char* field, const Type& value)
+		{
+			if constexpr (MessageValue<Type>::Type() == B_ANY_TYPE) {
+				// only plain data survives being copied byte by byte
+				if constexpr (is_trivially_copyable_v<Type>)
+					return archive->AddData(field, B_ANY_TYPE, &value, sizeof(Type));
+				else
+					return B_NOT_SUPPORTED;
+			} else {
+				BMSG(archive, garchive);
+				garchive[field] = value;
+				return B_OK;
+			}
+		}
+
+		template <typename Type>
+		optional<Type>
+		UnarchiveValue(const BMessage& archive, const char* field)
+		{
+			type_code type;
+			if (archive.GetInfo(field, &type) != B_OK)
+				return nullopt;
+
+			if constexpr (MessageValue<Type>::Type() == B_ANY_TYPE) {
+				if constexpr (is_trivially_copyable_v<Type> && is_default_constructible_v<Type>) {
+					ssize_t size = 0;
+					const void *data;
+					if (archive.FindData(field, type, &data, &size) == B_OK
+						&& size == sizeof(Type)) {
+						Type value;
+						memcpy(&value, data, sizeof(Type));
+						return value;
+					}
+				}
+				return nullopt;
+			} else {
+				BMSG(&archive, garchive);
+				return (Type)garchive[field];
+			}
+		}
+	}
+
+	template <typename ResultType>
+	class Task;
+
+	// Within the team the result message only refers to the worker's
+	// ResultSlot and the result is moved, never copied or flattened.
+	// Archive() serializes the result itself, for messages leaving the team.
+	template <typename ResultType>
+	class TaskResult: public BArchivable {
+	public:
+		using value_type = result_value_t<ResultType>;
+
+		TaskResult(const BString& name, thread_id id, ResultSlot<ResultType>* slot)
+			:
+			fId(id),
+			fName(name),
+			fSlot(slot)
+		{
+		}
+		// Takes the slot of a local result out of the SlotRegistry, so the
+		// result of a message, or of its copies, can be built only once;
+		// another TaskResult of it has none.
+		TaskResult(const BMessage &archive)
+			:
+			fId(-1)
+		{
+			_Unarchive(archive);
+		}
+
+		// Like the above, also removes the slot field from the message
+		TaskResult(BMessage* archive)
+			:
+			TaskResult(*archive)
+		{
+			archive->RemoveName(kSlotField);
+		}
+
+		~TaskResult()
+		{
+		}
+
+		ResultType	GetResult() const
+		{
+			if (fSlot.IsSet() && fSlot->Exception() != nullptr) {
+				rethrow_exception(fSlot->Exception());
+			} else {
+				if constexpr (std::is_void<ResultType>::value == false) {
+					return _Value();
+				}
+			}
+		}
+
+		// Moves the result out, GetResult() must not be called afterwards
+		ResultType	TakeResult()
+		{
+			if (fSlot.IsSet() && fSlot->Exception() != nullptr) {
+				rethrow_exception(fSlot->Exception());
+			} else {
+				if constexpr (std::is_void<ResultType>::value == false) {
+					return std::move(_Value());
+				}
+			}
+		}
+
+		virtual status_t Archive(BMessage *archive, bool deep) const
+		{
+			status_t status = _ArchiveHeader(archive, deep);
+			if (status != B_OK)
+				return status;
+
+			if constexpr (std::is_void<ResultType>::value == false) {
+				if (fSlot.IsSet() && fSlot->HasValue())
+					status = ArchiveValue(archive, kResultField, fSlot->Value());
+			}
+			if (status != B_OK)
+				return status;
+			return archive->AddString("class", "TaskResult");
+		}
+
+		// Like Archive() but hands the result slot to the SlotRegistry
+		// instead of adding the result, for messages sent to target within
+		// this team. The slot is only registered if this succeeds.
+		status_t ArchiveSlot(BMessage *archive, const BMessenger& target) const
+		{
+			status_t status = _ArchiveHeader(archive, false);
+			if (status == B_OK)
+				status = archive->AddString("class", "TaskResult");
+			if (status == B_OK && fSlot.IsSet())
+				status = archive->AddBool(kSlotField, true);
+			if (status == B_OK && fSlot.IsSet())
+				SlotRegistry::Default().Add(fId, fSlot.Get(), target);
+			return status;
+		}
+
+		static TaskResult<ResultType>* Instantiate(BMessage* archive)
+		{
+			if (validate_instantiation(archive, "TaskResult"))
+				return new TaskResult<ResultType>(archive);
+			return nullptr;
+		}
+
+		thread_id GetTaskID() const { return fId; }
+		const char* GetTaskName() const { return fName; }
+
+	private:
+		TaskResult() { debugger("called TaskResult private constructor!"); };
+
+		void _Unarchive(const BMessage& archive)
+		{
+			if (archive.FindInt32(kTaskIdField, &fId) != B_OK) {
+					throw runtime_error("Can't unarchive TaskResult instance: Task ID not available");
+			}
+			if (archive.FindString(kTaskNameField, &fName) != B_OK) {
+					throw runtime_error("Can't unarchive TaskResult instance: Task Name not available");
+			}
+
+			// the registry only means something within the team that posted
+			// the message
+			if (!archive.IsSourceRemote() && archive.HasBool(kSlotField)) {
+				BReference<BReferenceable> slot = SlotRegistry::Default().Take(fId);
+				fSlot.SetTo(dynamic_cast<ResultSlot<ResultType>*>(slot.Get()));
+				if (!fSlot.IsSet())
+					fSlot.SetTo(new ResultSlot<ResultType>(), true);
+				return;
+			}
+
+			fSlot.SetTo(new ResultSlot<ResultType>(), true);
+			if constexpr (std::is_void<ResultType>::value == false) {
+				optional<ResultType> value = UnarchiveValue<ResultType>(archive, kResultField);
+				if (value)
+					fSlot->SetValue(std::move(*value));
+			}
+		}
+
+		status_t _ArchiveHeader(BMessage *archive, bool deep) const
+		{
+			status_t status = BArchivable::Archive(archive, deep);
+			if (status != B_OK)
+				return status;
+			status = archive->AddInt32(kTaskIdField, fId);
+			if (status != B_OK)
+				return status;
+			return archive->AddString(kTaskNameField, fName);
+		}
+
+		value_type& _Value() const
+		{
+			if (!fSlot.IsSet() || !fSlot->HasValue())
+				throw runtime_error("TaskResult has no result");
+			return fSlot->Value();
+		}
+
+		const char*		kResultField = "TaskResult::Result";
+		const char*		kTaskIdField = "TaskResult::TaskID";
+		const char*		kTaskNameField = "TaskResult::TaskName";
+		const char*		kSlotField = "TaskResult::Slot";
+
+		thread_id		fId;
+		BString			fName;
+		BReference<ResultSlot<ResultType> > fSlot;
+	};
+
+
+	const int TASK_PROGRESS_MESSAGE = 'tfwp';
+
 	namespace Private {
 
-		struct ThreadData {
-			ThreadData(void* function, const BMessenger& srcMessenger, const BString& taskName) {
-				target_function = function;
-				messenger = srcMessenger;
-				name = taskName;
-			};
-			void *target_function;
-			BMessenger messenger;
-			thread_id id;
-			BString name;
-		};
+		class ProgressChannel;
+
+		// One progress message in flight. The message carries a reference;
+		// releasing it acknowledges the message to the channel.
+		class ProgressUpdate : public BReferenceable {
+		public:
+							ProgressUpdate(ProgressChannel* channel);
+			virtual			~ProgressUpdate();
+
+			virtual bool	HasPartial() const { return false; }
+
+		private:
+			BReference<ProgressChannel> fChannel;
+		};
+
+		template <typename PartialType>
+		class PartialUpdate : public ProgressUpdate {
+		public:
+			PartialUpdate(ProgressChannel* channel, PartialType&& partial)
+				:
+				ProgressUpdate(channel),
+				fPartial(std::move(partial))
+			{
+			}
+
+			virtual bool	HasPartial() const override { return true; }
+			PartialType&	Partial() { return fPartial; }
+
+		private:
+			PartialType		fPartial;
+		};
+
+		// Credit based flow control between a streaming task and the looper
+		// it reports to: at most window messages are unacknowledged at any
+		// time. Progress alone is coalesced while the window is full, the
+		// latest fraction is posted once the receiver caught up. Partial
+		// results are never dropped, the task waits for credit instead.
+		//
+		// Only local targets can acknowledge; messages leaving the team are
+		// throttled by the target port alone. A local target that goes away
+		// with messages still queued never acknowledges them, so a task
+		// waiting for credit gives up once the messenger is invalid.
+		class ProgressChannel : public BReferenceable {
+		public:
+			ProgressChannel(const char* name, const BMessenger& messenger, int32 id,
+				int32 window)
+				:
+				fName(name),
+				fMessenger(messenger),
+				fId(id),
+				fWindow(max(window, (int32)1)),
+				fLocal(messenger.IsTargetLocal()),
+				fInFlight(0),
+				fPendingProgress(-1),
+				fClosed(false)
+			{
+			}
+
+			void SetProgress(float fraction)
+			{
+				{
+					lock_guard<mutex> lock(fLock);
+					if (fClosed)
+						return;
+					if (fLocal && fInFlight >= fWindow) {
+						fPendingProgress = fraction;
+						return;
+					}
+					fPendingProgress = -1;
+					if (fLocal)
+						fInFlight++;
+				}
+				_Post(fraction, fLocal ? new ProgressUpdate(this) : nullptr, nullptr);
+			}
+
+			template <typename PartialType>
+			status_t Yield(PartialType&& partial, float fraction, const CancellationToken& token)
+			{
+				while (fLocal) {
+					{
+						lock_guard<mutex> lock(fLock);
+						if (fClosed)
+							return B_NOT_ALLOWED;
+						if (fInFlight < fWindow) {
+							fInFlight++;
+							// the partial carries the newest fraction
+							fPendingProgress = -1;
+							break;
+						}
+						fCredit.Reset();
+					}
+					status_t status = token.WaitFor(fCredit, kCreditCheckInterval);
+					if (status == B_CANCELED)
+						return B_CANCELED;
+					if (status == B_TIMED_OUT && !fMessenger.IsValid()) {
+						Close();
+						return B_BAD_PORT_ID;
+					}
+				}
+
+				if (!fLocal) {
+					BMessage archive;
+					status_t status = ArchiveValue(&archive, kPartialField, partial);
+					if (status != B_OK)
+						return status;
+					return _Post(fraction, nullptr, &archive);
+				}
+				return _Post(fraction, new PartialUpdate<PartialType>(this,
+					std::move(partial)), nullptr);
+			}
+
+			// Called when the task body returned, nothing is posted after
+			// the result
+			void Close()
+			{
+				lock_guard<mutex> lock(fLock);
+				fClosed = true;
+				fCredit.Signal();
+			}
+
+			void Acknowledge()
+			{
+				float pending;
+				{
+					lock_guard<mutex> lock(fLock);
+					fInFlight--;
+					fCredit.Signal();
+					pending = fPendingProgress;
+					if (pending < 0 || fClosed)
+						return;
+					fPendingProgress = -1;
+					fInFlight++;
+				}
+				_Post(pending, new ProgressUpdate(this), nullptr);
+			}
+
+			static constexpr const char* kTaskIdField = "TaskProgress::TaskID";
+			static constexpr const char* kTaskNameField = "TaskProgress::TaskName";
+			static constexpr const char* kProgressField = "TaskProgress::Progress";
+			static constexpr const char* kUpdateField = "TaskProgress::Update";
+			static constexpr const char* kPartialField = "TaskProgress::Partial";
+
+			static constexpr bigtime_t kCreditCheckInterval = 500000;
+
+		private:
+			// Takes over the reference of update
+			status_t _Post(float fraction, ProgressUpdate* update, const BMessage* partial)
+			{
+				BMessage message(TASK_PROGRESS_MESSAGE);
+				if (partial != nullptr)
+					message = *partial;
+				message.what = TASK_PROGRESS_MESSAGE;
+				message.AddInt32(kTaskIdField, fId);
+				message.AddString(kTaskNameField, fName);
+				if (fraction >= 0)
+					message.AddFloat(kProgressField, fraction);
+				if (update != nullptr)
+					message.AddPointer(kUpdateField, update);
+
+				status_t status = fMessenger.SendMessage(&message, (BHandler*)NULL);
+				if (status != B_OK && update != nullptr)
+					update->ReleaseReference();
+				return status;
+			}
+
+			BString				fName;
+			BMessenger			fMessenger;
+			int32				fId;
+			int32				fWindow;
+			bool				fLocal;
+
+			mutex				fLock;
+			TaskEvent			fCredit;
+			int32				fInFlight;
+			float				fPendingProgress;
+			bool				fClosed;
+		};
+
+
+		inline
+		ProgressUpdate::ProgressUpdate(ProgressChannel* channel)
+			:
+			fChannel(channel)
+		{
+		}
+
+
+		inline
+		ProgressUpdate::~ProgressUpdate()
+		{
+			fChannel->Acknowledge();
+		}
+	}
+
+	// Tag to give a task a ProgressReporter, see with_progress()
+	template <typename PartialType>
+	struct progress_t {
+		int32	window;
+	};
+
+	// At most window progress messages of the task are waiting in the
+	// target's queue. PartialType is the type of the partial results the
+	// task yields, void if it only reports progress.
+	template <typename PartialType = void>
+	inline constexpr progress_t<PartialType>
+	with_progress(int32 window = 4)
+	{
+		return progress_t<PartialType> { window };
+	}
+
+	// Handed to the body of a task created with with_progress(), reports
+	// to the task's messenger as TASK_PROGRESS_MESSAGE.
+	template <typename PartialType>
+	class ProgressReporter {
+	public:
+		ProgressReporter(ProgressChannel* channel, const CancellationToken& token)
+			:
+			fChannel(channel),
+			fToken(token)
+		{
+		}
+
+		~ProgressReporter()
+		{
+			fChannel->Close();
+		}
+
+		ProgressReporter(const ProgressReporter&) = delete;
+		ProgressReporter& operator=(const ProgressReporter&) = delete;
+
+		// Fraction done, between 0 and 1. Never blocks; while the receiver
+		// lags behind only the latest fraction is kept.
+		void SetProgress(float fraction) { fChannel->SetProgress(fraction); }
+
+		// Posts a partial result, waiting for the receiver to catch up
+		// first. Returns B_CANCELED if the task got stopped meanwhile.
+		template <typename Type = PartialType>
+		enable_if_t<!is_void_v<Type>, status_t>
+		Yield(Type&& partial, float fraction = -1)
+		{
+			return fChannel->Yield(std::move(partial), fraction, fToken);
+		}
+
+		const CancellationToken& Token() const { return fToken; }
+
+	private:
+		BReference<ProgressChannel> fChannel;
+		CancellationToken	fToken;
+	};
+
+	// Receiving end of TASK_PROGRESS_MESSAGE. Build one from every local
+	// progress message with TaskProgress(BMessage*), even if it gets
+	// ignored: the message holds credit of the task and destroying the
+	// TaskProgress that took it hands it back. Until then Yield() blocks.
+	template <typename PartialType = void>
+	class TaskProgress {
+	public:
+		// Reads the message without taking its credit over
+		TaskProgress(const BMessage& message)
+			:
+			fStatus(B_OK)
+		{
+			_Unarchive(message, false);
+		}
+
+		// Takes the credit over and removes it from the message, so it is
+		// handed back exactly once
+		TaskProgress(BMessage* message)
+			:
+			fStatus(B_OK)
+		{
+			if (_Unarchive(*message, true))
+				message->RemoveName(ProgressChannel::kUpdateField);
+		}
+
+		// B_BAD_TYPE if the message carries a partial result of another
+		// type than PartialType. TaskProgress<> ignores partial results.
+		status_t	InitCheck() const { return fStatus; }
+
+		thread_id	GetTaskID() const { return fId; }
+		const char*	GetTaskName() const { return fName; }
+
+		// Negative if the message only carries a partial result
+		float		Progress() const { return fProgress; }
+
+		template <typename Type = PartialType>
+		enable_if_t<!is_void_v<Type>, bool>
+		HasPartial() const
+		{
+			return _Update() != nullptr || fPartial.has_value();
+		}
+
+		// Moves the partial result out
+		template <typename Type = PartialType>
+		enable_if_t<!is_void_v<Type>, Type>
+		TakePartial()
+		{
+			if (PartialUpdate<Type>* update = _Update())
+				return std::move(update->Partial());
+			if (!fPartial)
+				throw runtime_error(fStatus == B_BAD_TYPE ? "TaskProgress partial result of another type"
+					: "TaskProgress has no partial result");
+			return std::move(*fPartial);
+		}
+
+	private:
+		// Returns true if it took over the credit of the message
+		bool _Unarchive(const BMessage& message, bool take)
+		{
+			fId = message.GetInt32(ProgressChannel::kTaskIdField, -1);
+			fName = message.GetString(ProgressChannel::kTaskNameField, "");
+			fProgress = message.GetFloat(ProgressChannel::kProgressField, -1);
+
+			void* update = nullptr;
+			if (!message.IsSourceRemote()
+				&& message.FindPointer(ProgressChannel::kUpdateField, &update) == B_OK) {
+				fUpdate.SetTo(reinterpret_cast<ProgressUpdate*>(update), take);
+				if constexpr (!is_void_v<PartialType>) {
+					if (fUpdate->HasPartial() && _Update() == nullptr)
+						fStatus = B_BAD_TYPE;
+				}
+				return take;
+			}
+			if constexpr (!is_void_v<PartialType>) {
+				fPartial = UnarchiveValue<PartialType>(message, ProgressChannel::kPartialField);
+				if (!fPartial && message.HasData(ProgressChannel::kPartialField, B_ANY_TYPE))
+					fStatus = B_BAD_TYPE;
+			}
+			return false;
+		}
+
+		template <typename Type = PartialType>
+		PartialUpdate<Type>* _Update() const
+		{
+			return dynamic_cast<PartialUpdate<Type>*>(fUpdate.Get());
+		}
+
+		status_t		fStatus;
+		thread_id		fId;
+		BString			fName;
+		float			fProgress;
+		BReference<ProgressUpdate> fUpdate;
+		optional<result_value_t<PartialType> > fPartial;
+	};
+
+
+	namespace Private {
+
+		// Where the result of a finished task goes: posted to the messenger
+		// as TASK_RESULT_MESSAGE, or handed to the completion when a
+		// combinator or continuation took the task over.
+		template <typename ResultType>
+		struct ResultSink {
+			ResultSink(const char* taskName, const BMessenger& target)
+				:
+				name(taskName),
+				messenger(target),
+				id(NextTaskId())
+			{
+			}
+
+			void Deliver(ResultSlot<ResultType>* slot)
+			{
+				if (completion) {
+					completion(slot);
+					return;
+				}
+				if (!messenger.IsValid())
+					return;
 
-		static exception_ptr current_exception_ptr;
-		static map<thread_id, exception_ptr> TaskExceptionMap;
-	}
+				TaskResult<ResultType> taskResult(name, id, slot);
+				BMessage msg(TASK_RESULT_MESSAGE);
+				bool local = messenger.IsTargetLocal();
+				status_t status = local ? taskResult.ArchiveSlot(&msg, messenger)
+					: taskResult.Archive(&msg, false);
+				if (status != B_OK) {
+					// Nobody on a worker thread could catch an exception. The
+					// message goes out without the result instead, so
+					// GetResult() throws for the receiver.
+					msg.MakeEmpty();
+					msg.what = TASK_RESULT_MESSAGE;
+					TaskResult<ResultType>(name, id, nullptr).Archive(&msg, false);
+					messenger.SendMessage(&msg);
+					return;
+				}
 
-	using namespace Private;
+				// nobody is going to take the slot out of the registry
+				if (messenger.SendMessage(&msg) != B_OK && local)
+					SlotRegistry::Default().Take(id);
+			}
 
-	const int TASK_RESULT_MESSAGE = 'tfwr';
+			// A stopped task posts nothing, but a completion still has to
+			// learn about it.
+			void Cancelled()
+			{
+				if (!completion)
+					return;
+				BReference<ResultSlot<ResultType> > slot(new ResultSlot<ResultType>(), true);
+				slot->SetException(make_exception_ptr(TaskCancelled()));
+				completion(slot);
+			}
 
-	template <typename ResultType>
-	class Task;
+			BString			name;
+			BMessenger		messenger;
+			int32			id;
+			function<void(ResultSlot<ResultType>*)> completion;
+		};
 
-	template <typename ResultType>
-	class TaskResult: public BArchivable {
-	public:
-		TaskResult(const BString& name, std::any result, thread_id id)
-			:
-			fResult(result),
-			fId(id),
-			fName(name)
+
+		// Moves the task from queued to running, returns false if it got
+		// stopped before
+		inline bool
+		StartTask(TaskState& state)
 		{
+			bool cancelled = state.token.IsCancelled();
+			int32 expected = kTaskQueued;
+			return state.status.compare_exchange_strong(expected,
+				cancelled ? kTaskCancelled : kTaskRunning) && !cancelled;
 		}
-		TaskResult(const BMessage &archive)
-			:
-			fResult(nullptr),
-			fId(-1)
-		{
-			if constexpr (std::is_void<ResultType>::value == false) {
-				type_code type;
-				if (archive.GetInfo(kResultField, &type) == B_OK) {
-					if constexpr ( MessageValue<ResultType>::Type() == B_ANY_TYPE) {
-						ssize_t size = 0;
-						const void *result;
-						status_t error = archive.FindData(kResultField, type,
-						reinterpret_cast<const void**>(&result), &size);
-						if (error == B_OK) {
-                           fResult = *reinterpret_cast<const ResultType*>(result);
-						}
-					} else {
-						BMSG(&archive, garchive);
-						fResult = (ResultType)garchive[kResultField];
-					}
-				}
+
+
+		template <typename Function, typename ... Args>
+		class arguments_wrapper {
+			std::decay_t<Function> callable;
+			std::tuple<std::decay_t<Args>...> args;
+		public:
+			static constexpr bool takes_token = std::is_invocable_v<std::decay_t<Function>&,
+				const CancellationToken&, std::decay_t<Args>...>;
+
+			arguments_wrapper(Function&& callable, Args&& ... args)
+				:
+				callable(std::forward<Function>(callable)),
+				args{std::forward<Args>(args)...}
+			{
 			}
 
-			if (archive.FindInt32(kTaskIdField, &fId) != B_OK) {
-					throw runtime_error("Can't unarchive TaskResult instance: Task ID not available");
+			constexpr decltype(auto) operator()()
+			{
+				return apply(std::make_index_sequence<sizeof...(Args)>{});
 			}
-			if (archive.FindString(kTaskNameField, &fName) != B_OK) {
-					throw runtime_error("Can't unarchive TaskResult instance: Task Name not available");
+
+			constexpr decltype(auto) operator()(const CancellationToken& token)
+			{
+				return apply(token, std::make_index_sequence<sizeof...(Args)>{});
 			}
-		}
 
-		~TaskResult()
-		{
-			fResult.reset();
-		}
+		private:
+			template <std::size_t ... indices>
+			constexpr decltype(auto) apply(std::index_sequence<indices...>)
+			{
+				return callable(std::move(std::get<indices>(args))...);
+			}
 
-		ResultType	GetResult() const
-		{
-			auto i = TaskExceptionMap.find(fId);
-			if (i != TaskExceptionMap.end()) {
-				auto ptr = std::move(i->second);
-				TaskExceptionMap.erase(i);
-				rethrow_exception(ptr);
-			} else {
-				if constexpr (std::is_void<ResultType>::value == false) {
-					return any_cast<ResultType>(fResult);
-				}
+			template <std::size_t ... indices>
+			constexpr decltype(auto) apply(const CancellationToken& token,
+				std::index_sequence<indices...>)
+			{
+				return callable(token, std::move(std::get<indices>(args))...);
 			}
-		}
 
-		virtual status_t Archive(BMessage *archive, bool deep) const
-		{
-			status_t status = BArchivable::Archive(archive, deep);
-			if (status != B_OK)
-				return status;
+		};
 
-			if constexpr (std::is_void<ResultType>::value == false) {
-				if (fResult.has_value()) {
-					ResultType result = any_cast<ResultType>(fResult);
-					if constexpr ( MessageValue<ResultType>::Type() == B_ANY_TYPE) {
-						status = archive->AddData(kResultField, B_ANY_TYPE, &result, sizeof(ResultType));
+
+		template <typename ResultType, typename Lambda>
+		class TaskJob : public Job {
+		public:
+			TaskJob(Lambda&& lambda, const shared_ptr<ResultSink<ResultType> >& sink,
+				const shared_ptr<TaskState>& state)
+				:
+				fLambda(std::move(lambda)),
+				fSink(sink),
+				fState(state)
+			{
+			}
+
+			virtual void Run() override
+			{
+				if (!StartTask(*fState)) {
+					fSink->Cancelled();
+					return;
+				}
+
+				BReference<ResultSlot<ResultType> > slot(new ResultSlot<ResultType>(), true);
+				try {
+					using ret_t = decltype(_Invoke());
+					if constexpr (std::is_same_v<void, ret_t>) {
+						_Invoke();
 					} else {
-						BMSG(archive, garchive);
-						garchive[kResultField] = result;
+						slot->SetValue(_Invoke());
 					}
+				} catch (...) {
+					slot->SetException(current_exception());
 				}
+				fState->status = kTaskFinished;
+
+				fSink->Deliver(slot);
 			}
-			if (status != B_OK)
-				return status;
-			status = archive->AddInt32(kTaskIdField, fId);
-			if (status != B_OK)
-				return status;
-			status = archive->AddString(kTaskNameField, fName);
-			if (status != B_OK)
-				return status;
-			status = archive->AddString("class", "TaskResult");
 
-			return status;
-		}
+		private:
+			decltype(auto) _Invoke()
+			{
+				if constexpr (Lambda::takes_token)
+					return fLambda(fState->token);
+				else
+					return fLambda();
+			}
 
-		static TaskResult<ResultType>* Instantiate(BMessage* archive)
-		{
-			if (validate_instantiation(archive, "TaskResult"))
-				return new TaskResult<ResultType>(*archive);
-			return nullptr;
-		}
+			Lambda					fLambda;
+			shared_ptr<ResultSink<ResultType> > fSink;
+			shared_ptr<TaskState>	fState;
+		};
 
-		thread_id GetTaskID() const { return fId; }
-		const char* GetTaskName() const { return fName; }
 
-	private:
-		TaskResult() { debugger("called TaskResult private constructor!"); };
+		// Queues the jobs of the tasks handed to a combinator once the
+		// combined task runs
+		class LaunchJob : public Job {
+		public:
+			LaunchJob(vector<Job*>&& jobs, const shared_ptr<TaskState>& state,
+				function<void()> cancelled)
+				:
+				fJobs(std::move(jobs)),
+				fState(state),
+				fCancelled(cancelled)
+			{
+			}
 
-		const char*		kResultField = "TaskResult::Result";
-		const char*		kTaskIdField = "TaskResult::TaskID";
-		const char*		kTaskNameField = "TaskResult::TaskName";
+			virtual ~LaunchJob()
+			{
+				for (Job* job : fJobs)
+					delete job;
+			}
 
-		any				fResult;
-		thread_id		fId;
-		BString			fName;
-	};
+			virtual void Run() override
+			{
+				if (!StartTask(*fState)) {
+					fCancelled();
+					return;
+				}
+
+				for (Job* job : fJobs)
+					Executor::Default().Submit(job);
+				fJobs.clear();
+			}
+
+		private:
+			vector<Job*>			fJobs;
+			shared_ptr<TaskState>	fState;
+			function<void()>		fCancelled;
+		};
+
+
+		template <typename ResultType, typename Function>
+		struct continuation_result {
+			using type = invoke_result_t<decay_t<Function>&, ResultType&&>;
+		};
+
+		template <typename Function>
+		struct continuation_result<void, Function> {
+			using type = invoke_result_t<decay_t<Function>&>;
+		};
+
+		struct TaskAccess;
+	}
 
 
 	template <typename ResultType>
@@ -164,107 +1419,405 @@ namespace Genio::Task {
 	public:
 		using native_handle_type = thread_id;
 
+		// Queue the task on the shared executor when Run() is called
 		template<typename Function, typename... Args>
 		Task(const char *name, const BMessenger& messenger, Function&& function, Args&&... args)
+			:
+			fJob(nullptr),
+			fThreadHandle(-1),
+			fSink(make_shared<ResultSink<ResultType> >(name, messenger)),
+			fState(make_shared<TaskState>())
 		{
-			auto targetFunction =
-				new arguments_wrapper<Function, Args...>(std::forward<Function>(function),
-				std::forward<Args>(args)...);
-
-			using lambda_type = std::remove_reference_t<decltype(*targetFunction)>;
+			fJob = _CreateJob(std::forward<Function>(function), std::forward<Args>(args)...);
+		}
 
-			ThreadData *threadData = new ThreadData(targetFunction, messenger, name);
+		// Like the above, but the body takes a ProgressReporter<PartialType>&
+		// as first argument to stream progress and partial results:
+		//	Task<int32> task("thumbnails", messenger, with_progress<BBitmap*>(),
+		//		[](ProgressReporter<BBitmap*>& progress, BEntry folder) { ... });
+		template<typename PartialType, typename Function, typename... Args>
+		Task(const char *name, const BMessenger& messenger, progress_t<PartialType> progress,
+			Function&& function, Args&&... args)
+			:
+			fJob(nullptr),
+			fThreadHandle(-1),
+			fSink(make_shared<ResultSink<ResultType> >(name, messenger)),
+			fState(make_shared<TaskState>())
+		{
+			BReference<ProgressChannel> channel(new ProgressChannel(name, messenger,
+				fSink->id, progress.window), true);
+			auto body = [channel, function = decay_t<Function>(std::forward<Function>(function))]
+				(const CancellationToken& token, auto&&... arguments) mutable -> ResultType {
+					ProgressReporter<PartialType> reporter(channel, token);
+					return function(reporter, std::move(arguments)...);
+				};
+			fJob = _CreateJob(std::move(body), std::forward<Args>(args)...);
+		}
 
-			fThreadHandle = spawn_thread(&_CallTarget<ThreadData, lambda_type>,
-										name,
-										B_NORMAL_PRIORITY,
-										threadData);
+		// Spawn a thread for the task, Run() resumes it
+		template<typename Function, typename... Args>
+		Task(dedicated_thread_t, const char *name, const BMessenger& messenger,
+			Function&& function, Args&&... args)
+			:
+			fJob(nullptr),
+			fThreadHandle(-1),
+			fSink(make_shared<ResultSink<ResultType> >(name, messenger)),
+			fState(make_shared<TaskState>())
+		{
+			Job* job = _CreateJob(std::forward<Function>(function), std::forward<Args>(args)...);
 
-			threadData->id = fThreadHandle;
+			fThreadHandle = spawn_thread(&_RunDedicated, name, B_NORMAL_PRIORITY, job);
 			if (fThreadHandle < 0) {
-				delete targetFunction;
-				delete threadData;
+				delete job;
 				throw runtime_error("Can't create task");
 			}
 		}
 
-		~Task() {}
+		// Leaves other without job and state: it can't be run or stopped
+		// anymore, its Token() is one of its own and SetToken() does nothing.
+		Task(Task&& other)
+			:
+			fJob(other.fJob),
+			fThreadHandle(other.fThreadHandle),
+			fSink(std::move(other.fSink)),
+			fState(std::move(other.fState))
+		{
+			other.fJob = nullptr;
+			other.fThreadHandle = -1;
+		}
+
+		Task(const Task&) = delete;
+		Task& operator=(const Task&) = delete;
+
+		~Task()
+		{
+			// never submitted
+			delete fJob;
+		}
 
 		status_t Run()
 		{
+			if (fJob != nullptr) {
+				Executor::Default().Submit(fJob);
+				fJob = nullptr;
+				return B_OK;
+			}
 			if (fThreadHandle > 0)
 				return resume_thread(fThreadHandle);
 			return B_ERROR;
 		}
+
+		// Asks the task to finish. A task that did not start yet is dropped
+		// without posting a result, a running one sees its token cancelled
+		// and is expected to return on its own.
 		status_t Stop()
 		{
-			if (fThreadHandle > 0)
-				return kill_thread(fThreadHandle);
-			return B_ERROR;
+			if (fState == nullptr)
+				return B_ERROR;
+
+			fState->token.Cancel();
+
+			int32 expected = kTaskQueued;
+			if (fState->status.compare_exchange_strong(expected, kTaskCancelled)) {
+				// a dedicated thread has to run to notice and exit
+				if (fThreadHandle > 0)
+					resume_thread(fThreadHandle);
+				return B_OK;
+			}
+			return expected == kTaskRunning ? B_OK : B_ERROR;
 		}
-	private:
-		native_handle_type fThreadHandle;
-
-		template<typename Data, typename Lambda>
-		static int32 _CallTarget(void *target)
-		{
-			Data *data = reinterpret_cast<Data*>(target);
-			Lambda* lambda = reinterpret_cast<Lambda*>(data->target_function);
-			std::any anyResult;
-			try {
-				using ret_t = decltype((*lambda)());
-				if constexpr (std::is_same_v<void, ret_t>) {
-					(*lambda)();
-					// TODO: anyResult is not initialized here
-				} else {
-					auto result = (*lambda)();
-					anyResult = result;
-				}
-			} catch (...) {
-				TaskExceptionMap[data->id] = current_exception();
+
+		// Bodies taking a CancellationToken as first argument receive this
+		// one. Replace it before Run() to share one token between tasks;
+		// Stop() then cancels all of them.
+		CancellationToken Token() const
+		{
+			return fState != nullptr ? fState->token : CancellationToken();
+		}
+
+		void SetToken(const CancellationToken& token)
+		{
+			if (fState != nullptr)
+				fState->token = token;
+		}
+
+		// Both must be set before Run(). Jobs with a deadline (an absolute
+		// system_time()) run earliest deadline first, ahead of the jobs of
+		// their priority class without one.
+		status_t SetPriority(task_priority priority)
+		{
+			if (fJob != nullptr) {
+				fJob->priority = priority;
+				return B_OK;
 			}
-			TaskResult<ResultType> taskResult(data->name, anyResult, data->id);
-			BMessenger messenger = data->messenger;
+			return B_NOT_ALLOWED;
+		}
 
-			delete lambda;
-			delete data;
+		status_t SetDeadline(bigtime_t deadline)
+		{
+			if (fJob != nullptr) {
+				fJob->deadline = deadline;
+				return B_OK;
+			}
+			return B_NOT_ALLOWED;
+		}
 
-			BMessage msg(TASK_RESULT_MESSAGE);
-			if (taskResult.Archive(&msg, false) == B_OK) {
-				if (messenger.IsValid()) {
-					messenger.SendMessage(&msg);
+		// Returns a task that runs the continuation on the executor with the
+		// result of this one and posts only the continuation's result; an
+		// exception skips the continuation and is posted instead. This task
+		// is consumed, Run() the returned one. The continuation inherits the
+		// priority this task has at this point.
+		template<typename Function>
+		auto Then(const char *name, const BMessenger& messenger, Function&& continuation)
+			-> Task<typename continuation_result<ResultType, Function>::type>
+		{
+			using next_type = typename continuation_result<ResultType, Function>::type;
+
+			if (fJob == nullptr)
+				throw runtime_error("Can't continue a task that already runs");
+
+			auto sink = make_shared<ResultSink<next_type> >(name, messenger);
+			auto state = make_shared<TaskState>();
+			state->token = fState->token;
+			auto function = make_shared<decay_t<Function> >(std::forward<Function>(continuation));
+			int32 priority = fJob->priority;
+
+			fSink->completion = [sink, state, function, priority](ResultSlot<ResultType>* slot) {
+				if (state->token.IsCancelled()) {
+					sink->Cancelled();
+					return;
 				}
-			} else {
-				throw runtime_error("Can't create TaskResult message");
-			}
+				if (slot->Exception() != nullptr) {
+					BReference<ResultSlot<next_type> > failed(new ResultSlot<next_type>(), true);
+					failed->SetException(slot->Exception());
+					state->status = kTaskFinished;
+					sink->Deliver(failed);
+					return;
+				}
+
+				BReference<ResultSlot<ResultType> > antecedent(slot);
+				auto body = [function, antecedent]() -> next_type {
+					if constexpr (is_void_v<ResultType>)
+						return (*function)();
+					else
+						return (*function)(std::move(antecedent->Value()));
+				};
+				using lambda_type = arguments_wrapper<decltype(body)>;
+				Job* job = new TaskJob<next_type, lambda_type>(lambda_type(std::move(body)),
+					sink, state);
+				job->priority = priority;
+				Executor::Default().Submit(job);
+			};
+
+			Task<next_type> next(fJob, sink, state);
+			fJob = nullptr;
+			return next;
+		}
+
+	private:
+		template<typename> friend class Task;
+		friend struct Private::TaskAccess;
+
+		Task(Job* job, const shared_ptr<ResultSink<ResultType> >& sink,
+			const shared_ptr<TaskState>& state)
+			:
+			fJob(job),
+			fThreadHandle(-1),
+			fSink(sink),
+			fState(state)
+		{
+		}
 
+		Job*				fJob;
+		native_handle_type	fThreadHandle;
+		shared_ptr<ResultSink<ResultType> > fSink;
+		shared_ptr<TaskState> fState;
+
+		template<typename Function, typename... Args>
+		Job* _CreateJob(Function&& function, Args&&... args)
+		{
+			using lambda_type = arguments_wrapper<Function, Args...>;
+			return new TaskJob<ResultType, lambda_type>(lambda_type(std::forward<Function>(function),
+				std::forward<Args>(args)...), fSink, fState);
+		}
+
+		static int32 _RunDedicated(void *data)
+		{
+			Job* job = reinterpret_cast<Job*>(data);
+			job->Run();
+			delete job;
 			return B_OK;
 		}
+	};
 
-		template <typename Function, typename ... Args>
-		class arguments_wrapper {
-			Function callable;
-			std::tuple<std::decay_t<Args>...> args;
-		public:
-			arguments_wrapper(Function&& callable, Args&& ... args)
+
+	namespace Private {
+
+		struct TaskAccess {
+			// The combinator takes the task over: it runs with the combined
+			// task's token and reports to the combinator instead of posting.
+			template <typename ResultType>
+			static Job* Adopt(Task<ResultType>& task, const CancellationToken& token,
+				type_identity_t<function<void(ResultSlot<ResultType>*)> > completion)
+			{
+				if (task.fJob == nullptr)
+					throw runtime_error("Can't combine a task that already runs");
+
+				task.fState->token = token;
+				task.fSink->completion = completion;
+				Job* job = task.fJob;
+				task.fJob = nullptr;
+				return job;
+			}
+
+			template <typename ResultType>
+			static Task<ResultType> Create(Job* job,
+				const shared_ptr<ResultSink<ResultType> >& sink,
+				const shared_ptr<TaskState>& state)
+			{
+				return Task<ResultType>(job, sink, state);
+			}
+		};
+
+
+		template <typename... Results>
+		struct WhenAllState {
+			using value_type = tuple<result_value_t<Results>...>;
+
+			WhenAllState(const char* name, const BMessenger& messenger)
 				:
-				callable(std::forward<Function>(callable)),
-				args{std::forward<Args>(args)...}
+				remaining(sizeof...(Results)),
+				failed(false),
+				sink(make_shared<ResultSink<value_type> >(name, messenger)),
+				state(make_shared<TaskState>()),
+				children(state->token)
 			{
 			}
 
-			constexpr decltype(auto) operator()()
+			template <size_t Index, typename ResultType>
+			void Complete(ResultSlot<ResultType>* slot)
 			{
-				return apply(std::make_index_sequence<sizeof...(Args)>{});
+				if (slot->Exception() != nullptr) {
+					if (!failed.exchange(true))
+						exception = slot->Exception();
+				} else if constexpr (is_void_v<ResultType>) {
+					get<Index>(values).emplace();
+				} else {
+					get<Index>(values).emplace(std::move(slot->Value()));
+				}
+
+				if (--remaining == 0)
+					_Finish(make_index_sequence<sizeof...(Results)>{});
 			}
 
-		private:
-			template <std::size_t ... indices>
-			constexpr decltype(auto) apply(std::index_sequence<indices...>)
+			template <size_t... Indices>
+			void _Finish(index_sequence<Indices...>)
 			{
-				return callable(std::move(std::get<indices>(args))...);
+				state->status = kTaskFinished;
+				if (failed && state->token.IsCancelled()) {
+					sink->Cancelled();
+					return;
+				}
+
+				BReference<ResultSlot<value_type> > slot(new ResultSlot<value_type>(), true);
+				if (failed)
+					slot->SetException(exception);
+				else
+					slot->SetValue(value_type(std::move(*get<Indices>(values))...));
+				sink->Deliver(slot);
 			}
 
+			atomic<int32>		remaining;
+			atomic<bool>		failed;
+			exception_ptr		exception;
+			tuple<optional<result_value_t<Results> >...> values;
+			shared_ptr<ResultSink<value_type> > sink;
+			shared_ptr<TaskState> state;
+			CancellationToken	children;
 		};
-	};
-}
\ No newline at end of file
+
+
+		template <typename... Results>
+		struct WhenAnyState {
+			using value_type = variant<result_value_t<Results>...>;
+
+			WhenAnyState(const char* name, const BMessenger& messenger)
+				:
+				decided(false),
+				sink(make_shared<ResultSink<value_type> >(name, messenger)),
+				state(make_shared<TaskState>()),
+				children(state->token.CreateLinked())
+			{
+			}
+
+			template <size_t Index, typename ResultType>
+			void Complete(ResultSlot<ResultType>* slot)
+			{
+				if (decided.exchange(true))
+					return;
+
+				// the others are not needed anymore; their token is separate
+				// from the one a continuation shares with this task
+				state->status = kTaskFinished;
+				children.Cancel();
+
+				BReference<ResultSlot<value_type> > result(new ResultSlot<value_type>(), true);
+				if (slot->Exception() != nullptr)
+					result->SetException(slot->Exception());
+				else if constexpr (is_void_v<ResultType>)
+					result->SetValue(value_type(in_place_index<Index>));
+				else
+					result->SetValue(value_type(in_place_index<Index>, std::move(slot->Value())));
+				sink->Deliver(result);
+			}
+
+			atomic<bool>		decided;
+			shared_ptr<ResultSink<value_type> > sink;
+			shared_ptr<TaskState> state;
+			CancellationToken	children;
+		};
+
+
+		template <typename State, typename... Results, size_t... Indices>
+		Task<typename State::value_type>
+		Combine(const shared_ptr<State>& combined, index_sequence<Indices...>,
+			Task<Results>&... tasks)
+		{
+			vector<Job*> jobs;
+			(jobs.push_back(TaskAccess::Adopt(tasks, combined->children,
+				[combined](ResultSlot<Results>* slot) {
+					combined->template Complete<Indices>(slot);
+				})), ...);
+
+			shared_ptr<ResultSink<typename State::value_type> > sink = combined->sink;
+			Job* launch = new LaunchJob(std::move(jobs), combined->state,
+				[sink]() { sink->Cancelled(); });
+			return TaskAccess::Create(launch, combined->sink, combined->state);
+		}
+	}
+
+
+	// Runs the tasks in parallel and posts one TaskResult holding a tuple of
+	// all their results (std::monostate for void tasks) once the last one
+	// finished. If any of them throws, the first exception is posted
+	// instead. The tasks must not have been run, they are consumed.
+	template <typename... Results>
+	Task<tuple<result_value_t<Results>...> >
+	when_all(const char *name, const BMessenger& messenger, Task<Results>&... tasks)
+	{
+		auto combined = make_shared<WhenAllState<Results...> >(name, messenger);
+		return Combine(combined, index_sequence_for<Results...>{}, tasks...);
+	}
+
+
+	// Runs the tasks in parallel and posts one TaskResult holding a variant
+	// with the result of the first one to finish; variant::index() tells
+	// which. The others are cancelled through the shared token.
+	template <typename... Results>
+	Task<variant<result_value_t<Results>...> >
+	when_any(const char *name, const BMessenger& messenger, Task<Results>&... tasks)
+	{
+		auto combined = make_shared<WhenAnyState<Results...> >(name, messenger);
+		return Combine(combined, index_sequence_for<Results...>{}, tasks...);
+	}
+}